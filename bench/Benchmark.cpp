@@ -0,0 +1,387 @@
+// Benchmark.cpp: This file drives the recording pipeline without Node. Synthetic BGRA
+// frames are pushed through the same frame pool, queue, frame thread and encoder as
+// frames from JavaScript, and the sustained throughput, latencies and CPU usage are
+// reported once every frame has been written. Run it with --help for the options.
+
+#include <chrono>
+#include <memory>
+#include <set>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/resource.h>
+#include <thread>
+#include <vector>
+#include "FfmpegProcess.h"
+#include "FrameBudget.h"
+#include "FramePool.h"
+#include "FrameThread.h"
+#include "LatencyHistogram.h"
+#include "PipelineStats.h"
+#include "RingQueue.hpp"
+#include "VideoEncoder.h"
+#include "VideoOptions.h"
+
+using namespace std;
+
+// The number of frame buffers in flight, matching the pool used by the module
+#define DEFAULT_BUFFERS 8
+
+// The capacity of the queues that pass frames to and from the frame thread
+#define FRAME_QUEUE_CAPACITY 1024
+
+typedef struct
+{
+  uint32_t width = 1920;
+  uint32_t height = 1080;
+  uint32_t captureWidth = 0;
+  uint32_t captureHeight = 0;
+  uint32_t fps = 60;
+  uint32_t frames = 600;
+  uint32_t buffers = DEFAULT_BUFFERS;
+  bool convertToYuv = true;
+  string sink = "null";
+  string ffmpegPath = "ffmpeg";
+  string encoder = "libx264";
+  string outputPath = "benchmark.mp4";
+  string preset;
+} BenchmarkOptions;
+
+// This encoder discards every frame, which measures the pipeline on its own
+class NullEncoder : public VideoEncoder
+{
+public:
+  string start() { return ""; }
+  bool writeFrame(uint8_t* data, uint32_t length, int64_t timestamp) { return true; }
+  void finish() {}
+};
+
+static void printUsage()
+{
+  printf("Usage: eyenative_bench [options]\n"
+    "  --size WxH        Size of the video (default 1920x1080)\n"
+    "  --capture WxH     Size of the captured frames, which are resized to the video\n"
+    "                    size (default same as the video)\n"
+    "  --fps N           Rate at which frames are produced, 0 for as fast as possible\n"
+    "                    (default 60)\n"
+    "  --frames N        Number of frames to push (default 600)\n"
+    "  --buffers N       Number of frame buffers in flight (default 8)\n"
+    "  --bgra            Send BGRA frames to the encoder instead of YUV 4:2:0\n"
+    "  --sink SINK       'null' discards frames in-process, 'ffmpeg' runs a real\n"
+    "                    encoder, anything else is a shell command that reads the\n"
+    "                    frames from stdin, e.g. 'cat >/dev/null' (default null)\n"
+    "  --ffmpeg PATH     ffmpeg executable for the ffmpeg sink (default ffmpeg)\n"
+    "  --encoder NAME    Encoder for the ffmpeg sink (default libx264)\n"
+    "  --preset NAME     Encoder preset for the ffmpeg sink\n"
+    "  --output PATH     Output file for the ffmpeg sink (default benchmark.mp4)\n");
+}
+
+static bool parseSize(const char* value, uint32_t& width, uint32_t& height)
+{
+  return (sscanf(value, "%ux%u", &width, &height) == 2) && (width > 0) && (height > 0);
+}
+
+static bool parseOptions(int argc, char** argv, BenchmarkOptions& options)
+{
+  for (int i = 1; i < argc; ++i)
+  {
+    string arg = argv[i];
+    const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+    bool needsValue = (arg != "--bgra") && (arg != "--help");
+    if (needsValue && (value == nullptr))
+    {
+      printf("Missing value for %s\n", arg.c_str());
+      return false;
+    }
+    if (arg == "--size")
+    {
+      if (!parseSize(value, options.width, options.height))
+      {
+        printf("Invalid size '%s'\n", value);
+        return false;
+      }
+    }
+    else if (arg == "--capture")
+    {
+      if (!parseSize(value, options.captureWidth, options.captureHeight))
+      {
+        printf("Invalid capture size '%s'\n", value);
+        return false;
+      }
+    }
+    else if (arg == "--fps")
+    {
+      options.fps = strtoul(value, nullptr, 10);
+    }
+    else if (arg == "--frames")
+    {
+      options.frames = strtoul(value, nullptr, 10);
+    }
+    else if (arg == "--buffers")
+    {
+      options.buffers = max((uint32_t)strtoul(value, nullptr, 10), (uint32_t)1);
+    }
+    else if (arg == "--sink")
+    {
+      options.sink = value;
+    }
+    else if (arg == "--ffmpeg")
+    {
+      options.ffmpegPath = value;
+    }
+    else if (arg == "--encoder")
+    {
+      options.encoder = value;
+    }
+    else if (arg == "--preset")
+    {
+      options.preset = value;
+    }
+    else if (arg == "--output")
+    {
+      options.outputPath = value;
+    }
+    else if (arg == "--bgra")
+    {
+      options.convertToYuv = false;
+    }
+    else
+    {
+      printUsage();
+      return false;
+    }
+    if (needsValue)
+    {
+      i += 1;
+    }
+  }
+  if (options.captureWidth == 0)
+  {
+    options.captureWidth = options.width;
+    options.captureHeight = options.height;
+  }
+  return true;
+}
+
+// Fills a buffer with a gradient the first time it's used, then moves a bar down the
+// frame so consecutive frames differ without rewriting the whole buffer
+static void drawFrame(uint8_t* data, uint32_t width, uint32_t height,
+  uint32_t frameNumber, bool fresh)
+{
+  if (fresh)
+  {
+    for (uint32_t y = 0; y < height; ++y)
+    {
+      uint8_t* row = data + (size_t)y * width * 4;
+      for (uint32_t x = 0; x < width; ++x)
+      {
+        row[x * 4] = (uint8_t)(x * 255 / width);
+        row[x * 4 + 1] = (uint8_t)(y * 255 / height);
+        row[x * 4 + 2] = (uint8_t)((x + y) & 0xff);
+        row[x * 4 + 3] = 0xff;
+      }
+    }
+  }
+  uint32_t barHeight = min(height, (uint32_t)16);
+  uint32_t barTop = (frameNumber * barHeight) % (height - barHeight + 1);
+  memset(data + (size_t)barTop * width * 4, (uint8_t)(frameNumber * 7),
+    (size_t)barHeight * width * 4);
+}
+
+static double cpuSeconds(int who)
+{
+  struct rusage usage;
+  if (getrusage(who, &usage) != 0)
+  {
+    return 0;
+  }
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+    usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+static void printHistogram(const char* name, HistogramSummary summary)
+{
+  if (summary.count == 0)
+  {
+    printf("  %-20s %10s\n", name, "-");
+    return;
+  }
+  printf("  %-20s %10llu %9.1f %9llu %9llu %9llu %9llu %9llu\n", name,
+    (unsigned long long)summary.count, summary.mean, (unsigned long long)summary.p50,
+    (unsigned long long)summary.p90, (unsigned long long)summary.p99,
+    (unsigned long long)summary.p999, (unsigned long long)summary.max);
+}
+
+// Returns completed frames' buffers to the pool and records how long each frame took
+// from being queued to being completed
+static void releaseCompletedFrames(shared_ptr<RingQueue<FrameWrapper*>> completedQueue,
+  shared_ptr<PipelineStats> stats, LatencyHistogram& endToEnd, uint32_t& completed)
+{
+  for (FrameWrapper* wrapper : completedQueue->waitAllItems(0))
+  {
+    stats->recordStage(STAGE_COMPLETION_TO_RELEASE, wrapper->completedTime);
+    endToEnd.record(wrapper->completedTime - wrapper->queuedTime);
+    completed += 1;
+    delete wrapper;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  BenchmarkOptions options;
+  if (!parseOptions(argc, argv, options))
+  {
+    return 1;
+  }
+  VideoOptions videoOptions;
+  videoOptions.convertToYuv = options.convertToYuv &&
+    (options.width % 2 == 0) && (options.height % 2 == 0);
+  videoOptions.encoderOptions.preset = options.preset;
+
+  // Create the sink. Shell commands are started through the raw process constructor,
+  // which pipes the frames to the command's stdin
+  shared_ptr<VideoEncoder> encoder;
+  string sinkName = options.sink;
+  if (options.sink == "null")
+  {
+    encoder = shared_ptr<VideoEncoder>(new NullEncoder());
+  }
+  else if (options.sink == "ffmpeg")
+  {
+    string error = encoderoptions::resolve(options.encoder, videoOptions.encoderOptions);
+    if (!error.empty())
+    {
+      printf("%s\n", error.c_str());
+      return 1;
+    }
+    encoder = shared_ptr<VideoEncoder>(new FfmpegProcess(options.ffmpegPath,
+      options.width, options.height, max(options.fps, (uint32_t)1), options.encoder,
+      options.outputPath, videoOptions));
+    sinkName = options.ffmpegPath + " (" + options.encoder + ")";
+  }
+  else
+  {
+    encoder = shared_ptr<VideoEncoder>(new FfmpegProcess("/bin/sh",
+      vector<string>({"-c", options.sink})));
+  }
+  string error = encoder->start();
+  if (!error.empty())
+  {
+    printf("Failed to start sink: %s\n", error.c_str());
+    return 1;
+  }
+
+  // Set up the pipeline the same way createVideoOutput() does
+  shared_ptr<RingQueue<FrameWrapper*>> pendingQueue(
+    new RingQueue<FrameWrapper*>(FRAME_QUEUE_CAPACITY));
+  shared_ptr<RingQueue<FrameWrapper*>> completedQueue(
+    new RingQueue<FrameWrapper*>(FRAME_QUEUE_CAPACITY));
+  shared_ptr<FramePool> framePool(new FramePool(options.buffers));
+  shared_ptr<FrameBudget> frameBudget(new FrameBudget(0));
+  shared_ptr<PipelineStats> stats(new PipelineStats());
+  shared_ptr<FrameThread> frameThread(new FrameThread(encoder, pendingQueue,
+    completedQueue, framePool, frameBudget, stats, options.width, options.height,
+    max(options.fps, (uint32_t)1), videoOptions));
+  frameThread->spawn();
+
+  printf("Pushing %u frames of %ux%u resized to %ux%u at %s fps into %s\n",
+    options.frames, options.captureWidth, options.captureHeight, options.width,
+    options.height, (options.fps == 0) ? "unlimited" : to_string(options.fps).c_str(),
+    sinkName.c_str());
+
+  // Produce frames at the requested rate. When every buffer is in flight the producer
+  // waits for one to complete, just as JavaScript waits for a free buffer
+  LatencyHistogram endToEnd;
+  set<uint8_t*> drawnBuffers;
+  uint32_t completed = 0;
+  uint32_t lateFrames = 0;
+  double startCpu = cpuSeconds(RUSAGE_SELF);
+  chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+  for (uint32_t i = 0; (i < options.frames) && frameThread->isRunning(); ++i)
+  {
+    if (options.fps != 0)
+    {
+      chrono::steady_clock::time_point due = startTime +
+        chrono::microseconds((int64_t)i * 1000000 / options.fps);
+      if (chrono::steady_clock::now() > due)
+      {
+        lateFrames += 1;
+      }
+      this_thread::sleep_until(due);
+    }
+
+    uint32_t bufferHandle = 0;
+    shared_ptr<FrameMemory> memory;
+    while (!framePool->acquire(options.captureWidth, options.captureHeight,
+      bufferHandle, memory) && frameThread->isRunning())
+    {
+      releaseCompletedFrames(completedQueue, stats, endToEnd, completed);
+      this_thread::sleep_for(chrono::microseconds(100));
+    }
+    if (memory == nullptr)
+    {
+      break;
+    }
+    bool fresh = drawnBuffers.insert(memory->data).second;
+    drawFrame(memory->data, options.captureWidth, options.captureHeight, i, fresh);
+
+    FrameWrapper* wrapper = new FrameWrapper;
+    framePool->submit(bufferHandle, wrapper->frame, wrapper->length, wrapper->width,
+      wrapper->height);
+    wrapper->id = i;
+    wrapper->handle = bufferHandle;
+    wrapper->timestamp = PipelineStats::now();
+    wrapper->queuedTime = wrapper->timestamp;
+    wrapper->duplicate = false;
+    wrapper->state = FRAME_QUEUED;
+    if (!pendingQueue->addItem(wrapper))
+    {
+      framePool->release(bufferHandle);
+      delete wrapper;
+      break;
+    }
+    stats->addQueuedFrame(pendingQueue->size());
+    releaseCompletedFrames(completedQueue, stats, endToEnd, completed);
+  }
+
+  // Wait for the frame thread to write everything, then stop it and the sink
+  uint32_t queued = (uint32_t)stats->getSnapshot().queuedFrames;
+  while ((completed < queued) && frameThread->isRunning())
+  {
+    releaseCompletedFrames(completedQueue, stats, endToEnd, completed);
+    this_thread::sleep_for(chrono::milliseconds(1));
+  }
+  double elapsed = chrono::duration<double>(chrono::steady_clock::now() -
+    startTime).count();
+  double pipelineCpu = cpuSeconds(RUSAGE_SELF) - startCpu;
+  frameThread->finish();
+  releaseCompletedFrames(completedQueue, stats, endToEnd, completed);
+  encoder->finish();
+  double sinkCpu = cpuSeconds(RUSAGE_CHILDREN);
+
+  // Report the results
+  StatsSnapshot snapshot = stats->getSnapshot();
+  double frames = (double)max(snapshot.writtenFrames, (uint64_t)1);
+  double capturedBytes = (double)completed * options.captureWidth *
+    options.captureHeight * 4;
+  printf("\nFrames written:      %llu of %u in %.2f s (%u produced late)\n",
+    (unsigned long long)snapshot.writtenFrames, options.frames, elapsed, lateFrames);
+  printf("Sustained rate:      %.1f fps\n", snapshot.writtenFrames / elapsed);
+  printf("Captured data:       %.1f MB/s\n", capturedBytes / elapsed / 1e6);
+  printf("Encoder data:        %.1f MB/s\n", snapshot.writtenBytes / elapsed / 1e6);
+  printf("Pipeline CPU:        %.3f ms per frame (%.0f%% of one core)\n",
+    pipelineCpu * 1000 / frames, pipelineCpu * 100 / elapsed);
+  if (options.sink != "null")
+  {
+    printf("Sink CPU:            %.3f ms per frame\n", sinkCpu * 1000 / frames);
+  }
+  printf("Max queue depth:     %u\n", snapshot.maxQueueDepth);
+  printf("\nLatency (us)              count      mean       p50       p90       p99"
+    "     p99.9       max\n");
+  for (uint32_t i = 0; i < STAGE_COUNT; ++i)
+  {
+    printHistogram(PipelineStats::stageName(i), snapshot.stages[i]);
+  }
+  printHistogram("endToEnd", endToEnd.summarize());
+  return (snapshot.writtenFrames == options.frames) ? 0 : 1;
+}
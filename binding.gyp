@@ -1,17 +1,40 @@
 {
+  "variables": {
+    "use_libav%": 0,
+    # The recording pipeline, which doesn't depend on Node and is shared by the module
+    # and the benchmark
+    "core_sources": [
+      "src/ColorConvert.cpp",
+      "src/Downscale.cpp",
+      "src/EncoderOptions.cpp",
+      "src/FfmpegProcess.cpp",
+      "src/FfmpegProgress.cpp",
+      "src/FrameThread.cpp",
+      "src/FrameBudget.cpp",
+      "src/FrameHeader.cpp",
+      "src/FramePool.cpp",
+      "src/LatencyHistogram.cpp",
+      "src/Matroska.cpp",
+      "src/PipelineStats.cpp",
+      "src/PipeReader.cpp",
+      "src/PipeWriter.cpp",
+      "src/Reactor.cpp",
+      "src/SegmentedEncoder.cpp",
+      "src/SharedFrameRing.cpp",
+      "src/Thread.cpp"
+    ]
+  },
   "targets": [{
     "target_name": "eyenative",
     "cflags!": [ "-fno-exceptions" ],
     "cflags_cc!": [ "-fno-exceptions" ],
     "sources": [
-      "src/FfmpegProcess.cpp",
-      "src/FrameThread.cpp",
-      "src/FrameHeader.cpp",
+      "<@(core_sources)",
       "src/main.cpp",
       "src/Native.cpp",
-      "src/PipeReader.cpp",
+      "src/PreviewFramePool.cpp",
       "src/PreviewThread.cpp",
-      "src/Thread.cpp",
+      "src/QoiEncoder.cpp",
       "src/Wrapper.cpp",
     ],
     'include_dirs': [
@@ -22,9 +45,35 @@
     ],
     'defines': [ 'NAPI_DISABLE_CPP_EXCEPTIONS' ],
     'conditions': [
+      ['use_libav==1', {
+        "sources": [
+          "src/AvcodecEncoder.cpp"
+        ],
+        'defines': [ 'EYE_NATIVE_LIBAV' ],
+        'include_dirs': [
+          "<!@(pkg-config --cflags-only-I libavcodec libavformat libavutil libswscale | sed s/-I//g)"
+        ],
+        'libraries': [
+          "<!@(pkg-config --libs libavcodec libavformat libavutil libswscale)"
+        ]
+      }],
+      ['target_arch=="x64"', {
+        'dependencies': [ "eyenative_avx2" ],
+        'defines': [ 'EYE_NATIVE_AVX2' ]
+      }],
       ['OS=="linux"', {
-        'include_dirs': [],
-        'library_dirs': []
+        "sources": [
+          "src/Platform_Linux.cpp"
+        ],
+        'include_dirs': [
+          "<!@(pkg-config --cflags-only-I opencv4 | sed s/-I//g)"
+        ],
+        'library_dirs': [],
+        'libraries': [
+          "<!@(pkg-config --libs opencv4)",
+          "-lpthread",
+          "-lrt"
+        ]
       }],
       ['OS=="mac"', {
         "sources": [
@@ -106,5 +155,101 @@
         ]
       }]
     ]
-  }]
+  }],
+  'conditions': [
+    # A standalone executable that pushes synthetic frames through the pipeline. It
+    # reports CPU time using getrusage() so it isn't built on Windows
+    ['OS!="win"', {
+      'targets': [{
+        "target_name": "eyenative_bench",
+        "type": "executable",
+        "cflags!": [ "-fno-exceptions" ],
+        "cflags_cc!": [ "-fno-exceptions" ],
+        "sources": [
+          "<@(core_sources)",
+          "bench/Benchmark.cpp"
+        ],
+        'include_dirs': [
+          "src/"
+        ],
+        'conditions': [
+          ['target_arch=="x64"', {
+            'dependencies': [ "eyenative_avx2" ],
+            'defines': [ 'EYE_NATIVE_AVX2' ]
+          }],
+          ['OS=="linux"', {
+            "sources": [
+              "src/Platform_Linux.cpp"
+            ],
+            'include_dirs': [
+              "<!@(pkg-config --cflags-only-I opencv4 | sed s/-I//g)"
+            ],
+            'libraries': [
+              "<!@(pkg-config --libs opencv4)",
+              "-lpthread",
+              "-lrt"
+            ]
+          }],
+          ['OS=="mac"', {
+            "sources": [
+              "src/Platform_Mac.cpp"
+            ],
+            'include_dirs': [
+              "opencv/mac/include/"
+            ],
+            'library_dirs': [
+              "../opencv/mac/lib/"
+            ],
+            'xcode_settings': {
+              "MACOSX_DEPLOYMENT_TARGET": "10.15"
+            },
+            'libraries': [
+              "-Wl,-rpath,./build/Release/",
+              "-lopencv_core",
+              "-lopencv_imgcodecs",
+              "-lopencv_imgproc"
+            ]
+          }]
+        ]
+      }]
+    }],
+    # The image kernels are compiled a second time with AVX2 enabled. They live in a
+    # separate library because the flags must not apply to anything else
+    ['target_arch=="x64"', {
+      'targets': [{
+        "target_name": "eyenative_avx2",
+        "type": "static_library",
+        "sources": [
+          "src/Kernels_avx2.cpp"
+        ],
+        'conditions': [
+          ['OS=="linux"', {
+            'include_dirs': [
+              "<!@(pkg-config --cflags-only-I opencv4 | sed s/-I//g)"
+            ],
+            'cflags': [ "-mavx2", "-mfma", "-fPIC" ]
+          }],
+          ['OS=="mac"', {
+            'include_dirs': [
+              "opencv/mac/include/"
+            ],
+            'xcode_settings': {
+              "MACOSX_DEPLOYMENT_TARGET": "10.15",
+              "OTHER_CFLAGS": [ "-mavx2", "-mfma" ]
+            }
+          }],
+          ['OS=="win"', {
+            'include_dirs': [
+              "opencv/win/include/"
+            ],
+            'msvs_settings': {
+              'VCCLCompilerTool': {
+                'EnableEnhancedInstructionSet': '5'
+              }
+            }
+          }]
+        ]
+      }]
+    }]
+  ]
 }
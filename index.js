@@ -44,35 +44,196 @@ function initializeFfmpeg(ffmpegPath) {
 /**
  * Use the functions in this section to create a new video file, queue frames to be
  * written to that file, check periodically to see which frames have been processed,
- * and close the file when finished.
+ * and close the file when finished. createVideoOutput() returns a handle that's
+ * passed to every other function in this section, so several files can be recorded
+ * at the same time, each with its own encoder and frame thread.
+ *
+ * The optional options object passed to createVideoOutput() supports the following:
+ *
+ * - pixelFormat: 'yuv420p' (default) converts frames to YUV before they're sent to
+ *   the encoder, 'bgra' sends the captured pixels and lets FFmpeg convert them
+ * - colorMatrix: 'bt601' (default) or 'bt709'
+ * - colorRange: 'limited' (default) or 'full'
+ * - backend: 'ffmpeg' (default) pipes frames to the FFmpeg executable, 'libav' encodes
+ *   them inside this process and requires a build with use_libav=1, in which case
+ *   initializeFfmpeg() isn't needed
+ * - elideDuplicates: true to skip frames that are identical to the previous one,
+ *   such as a held image, instead of encoding them again. The frames that are
+ *   written keep their timestamps so the video's timing doesn't change, and the
+ *   last frame is held until the output is closed. Can't be combined with
+ *   segmentWorkers
+ * - timestamps: 'frame' (default) spaces the frames evenly at the frame rate, so a
+ *   dropped frame shortens the video. 'capture' uses the time each frame was
+ *   captured as its presentation time, giving a variable frame rate video that
+ *   stays in sync with wall-clock time. The fps is then only a hint for the
+ *   encoder. Can't be combined with segmentWorkers
+ * - maxQueuedBytes: The number of bytes of frames that can wait to be encoded, 1 GiB
+ *   by default or zero for no limit
+ * - overloadPolicy: What queueNextFrame() does with a frame that doesn't fit:
+ *   - 'drop-newest' (default) drops the new frame
+ *   - 'block' waits for the encoder to catch up
+ *   - 'drop-oldest' drops the oldest waiting frame, which is still reported as
+ *     completed so its buffer can be reused
+ *   - 'duplicate-last' drops the new frame and writes the previous frame again in
+ *     its place, so the video keeps its length
+ * - segmentWorkers: Encode the video in parallel with this many ffmpeg processes,
+ *   each writing its own segments, which are joined without re-encoding when the
+ *   output is closed. Suited to offline renders, since each worker buffers up to a
+ *   whole segment of frames. Requires the ffmpeg backend
+ * - segmentFrames: The number of frames in each segment, which must be a multiple of
+ *   encoderOptions.gop. Defaults to the GOP or two seconds of frames
+ * - encoderOptions: An object with the encoder's quality and speed settings, which
+ *   are checked against the chosen encoder:
+ *   - profile: 'realtime-fast', 'balanced' or 'archival-lossless' fill in any of
+ *     the settings below that aren't given
+ *   - preset: The speed preset, such as 'veryfast' for libx264 and libx265, 'p1' to
+ *     'p7' for NVENC, or 'good', 'best' or 'realtime' for libvpx
+ *   - crf: Constant quality, where lower is better (cq for NVENC)
+ *   - bitrate: The target bitrate in kilobits per second
+ *   - gop: The maximum number of frames between key frames
+ *   - threads: The number of encoder threads, zero for automatic
+ *   - tune: The encoder tuning, such as 'zerolatency'
+ *   - slices: The number of slices per frame for libx264 and FFV1
+ *   - lossless: true to encode without loss. Combine with pixelFormat 'bgra' and
+ *     libx264rgb or ffv1 to keep the captured pixels exactly
  */
 
-function createVideoOutput(width, height, fps, encoder, outputPath) {
+function createVideoOutput(width, height, fps, encoder, outputPath, options) {
   if (native === null) {
     throw new Error('Native module has not been initialized');
   }
-  return native.createVideoOutput(width, height, fps, encoder, outputPath);
+  return native.createVideoOutput(width, height, fps, encoder, outputPath, options);
 }
 
-function queueNextFrame(buffer, width, height) {
+/**
+ * queueNextFrame() returns an { id, status } object. The status is 'accepted',
+ * 'delayed' if the call had to wait for room, 'dropped', or 'duplicated' if the
+ * previous frame was written in its place. Only accepted and delayed frames have an
+ * ID and are later reported as completed, the buffers of other frames can be reused
+ * immediately. getDroppedFrames() returns the number of frames dropped so far.
+ *
+ * Both queueNextFrame() and submitFrame() take an optional capture timestamp in
+ * milliseconds, such as the value of performance.now() when the frame was drawn,
+ * which is used with the 'capture' timestamps option. Frames without one are stamped
+ * with a monotonic clock when they're queued. Only differences between timestamps
+ * matter, but they come from different clocks, so either pass a timestamp with every
+ * frame or with none.
+ */
+
+function queueNextFrame(output, buffer, width, height, timestamp) {
+  if (native === null) {
+    throw new Error('Native module has not been initialized');
+  }
+  return native.queueNextFrame(output, buffer, width, height, timestamp);
+}
+
+function getDroppedFrames(output) {
+  if (native === null) {
+    throw new Error('Native module has not been initialized');
+  }
+  return native.getDroppedFrames(output);
+}
+
+/**
+ * getStats() returns the counters and stage timings of a video output, or null if
+ * the output doesn't exist. Pass true as the second argument to reset them after
+ * they've been read, such as at the start of each recording. The object contains:
+ *
+ * - queuedFrames, writtenFrames, writtenBytes and droppedFrames since the last reset
+ * - queueDepth and queuedBytes: The frames and bytes waiting for the frame thread now
+ * - maxQueueDepth: The most frames that have been waiting since the last reset
+ * - stages: Timings for queueWait (queued until taken by the frame thread), resize
+ *   (scaling and color conversion), encoderWrite, previewWrite and
+ *   completionToRelease (completed until handed back to JavaScript). Each has a
+ *   count and the min, mean, p50, p90, p99, p999 and max durations in microseconds.
+ *   The percentiles are accurate to within about 3%
+ */
+
+function getStats(output, reset) {
+  if (native === null) {
+    throw new Error('Native module has not been initialized');
+  }
+  return native.getStats(output, reset === true);
+}
+
+/**
+ * getEncoderProgress() returns the latest progress reported by the ffmpeg process,
+ * which is updated a few times a second, or null if it hasn't reported any yet or the
+ * output uses the libav backend or segmentWorkers. The object contains:
+ *
+ * - frame and fps: The number of frames encoded and the current encoding rate
+ * - speed: The encoding rate relative to real time. Below 1 the encoder is falling
+ *   behind and frames will back up in the queue
+ * - outTime: The timestamp of the latest output in milliseconds
+ * - dupFrames and dropFrames: Frames ffmpeg duplicated or dropped itself
+ * - totalSize: The size of the output so far in bytes
+ * - lagFrames: Frames written to ffmpeg that it hasn't encoded yet
+ * - ended: true once ffmpeg has finished
+ */
+
+function getEncoderProgress(output) {
+  if (native === null) {
+    throw new Error('Native module has not been initialized');
+  }
+  return native.getEncoderProgress(output);
+}
+
+/**
+ * As an alternative to queueNextFrame(), frames can be written into buffers owned by
+ * the native module. Call acquireFrameBuffer() to get a { handle, buffer } object (or
+ * null if every buffer is in use), fill the buffer with a BGRA frame of the given
+ * size, and pass the handle to submitFrame(). The buffer must not be touched after it
+ * has been submitted because it is recycled as soon as the frame has been written.
+ */
+
+function acquireFrameBuffer(output, width, height) {
   if (native === null) {
     throw new Error('Native module has not been initialized');
   }
-  return native.queueNextFrame(buffer, width, height);
+  return native.acquireFrameBuffer(output, width, height);
 }
 
-function checkCompletedFrames() {
+function submitFrame(output, handle, timestamp) {
   if (native === null) {
     throw new Error('Native module has not been initialized');
   }
-  return native.checkCompletedFrames();
+  return native.submitFrame(output, handle, timestamp);
 }
 
-function closeVideoOutput() {
+function checkCompletedFrames(output) {
   if (native === null) {
     throw new Error('Native module has not been initialized');
   }
-  native.closeVideoOutput();
+  return native.checkCompletedFrames(output);
+}
+
+/**
+ * Instead of polling checkCompletedFrames(), register a callback with
+ * onFramesCompleted() and it will be called with an Int32Array of frame IDs as soon
+ * as the frames have been written. IDs are batched when frames complete faster than
+ * the callback runs. Pass null to remove the callback. The callback is removed
+ * automatically when the video output is closed.
+ */
+
+function onFramesCompleted(output, callback) {
+  if (native === null) {
+    throw new Error('Native module has not been initialized');
+  }
+  native.onFramesCompleted(output, callback);
+}
+
+/**
+ * closeVideoOutput() waits for the encoder to finish writing the file. It returns the
+ * exit code of the ffmpeg process, which is zero on success and 128 plus the signal
+ * number if ffmpeg was killed, or null if the output uses the libav backend or
+ * segmentWorkers.
+ */
+
+function closeVideoOutput(output) {
+  if (native === null) {
+    throw new Error('Native module has not been initialized');
+  }
+  return native.closeVideoOutput(output);
 }
 
 /**
@@ -88,15 +249,41 @@ function closeVideoOutput() {
  * The functions in this section give us the ability to process a video in the main thread
  * and show a preview of it in a BrowserWindow, all without having to use the Electron
  * framework to pass the image between them. The channel should be created by the main
- * thread, and the browser window should open it, read each frame, and close it when
- * finished.
+ * thread for one of its video outputs, and the browser window should open it, read
+ * each frame, and close it when finished. Frames travel through a ring of shared
+ * memory slots when the platform allows it, in which case the channel name starts
+ * with "shm:", and through a named pipe otherwise.
+ *
+ * With shared memory the browser window tells the main thread how large the preview
+ * is, based on the last call to getNextFrame(), and how often it wants frames, set by
+ * setPreviewFrameRate() with zero meaning no limit. The main thread then scales and
+ * skips frames before sending them.
+ *
+ * getNextFrame() returns the most recent frame as PNG data, or null if there isn't a
+ * new one. Pass an options object to choose the format and receive an object with
+ * "data", "width", "height" and "number" fields instead:
+ *
+ * - format: "png" (default), "rgba" for raw pixels that can be copied into an
+ *   ImageData, "qoi" for fast lossless compression, or "jpeg"
+ * - quality: The JPEG quality from 0 to 100, 90 by default
+ * - newerThan: Return the latest frame if its number is greater than this, even if
+ *   it has been returned before, so a renderer can pass the number of the frame it
+ *   last showed. Frame numbers start from zero for each channel
+ *
+ * The last frame that was scaled and encoded is remembered, so asking for the same
+ * frame with the same size and options returns the same data without encoding it
+ * again. The data may be shared between calls and must not be modified.
+ *
+ * getNextFrameAsync() takes the same arguments and returns a promise that resolves
+ * with the same result. The frame is scaled and encoded on a worker thread so the
+ * browser window's event loop isn't blocked.
  */
 
-function createPreviewChannel() {
+function createPreviewChannel(output) {
   if (native === null) {
     throw new Error('Native module has not been initialized');
   }
-  return native.createPreviewChannel();
+  return native.createPreviewChannel(output);
 }
 
 function openPreviewChannel(name) {
@@ -106,11 +293,25 @@ function openPreviewChannel(name) {
   return native.openPreviewChannel(name);
 }
 
-function getNextFrame(maxWidth, maxHeight) {
+function getNextFrame(maxWidth, maxHeight, options) {
+  if (native === null) {
+    throw new Error('Native module has not been initialized');
+  }
+  return native.getNextFrame(maxWidth, maxHeight, options);
+}
+
+function getNextFrameAsync(maxWidth, maxHeight, options) {
+  if (native === null) {
+    throw new Error('Native module has not been initialized');
+  }
+  return native.getNextFrameAsync(maxWidth, maxHeight, options);
+}
+
+function setPreviewFrameRate(maxFps) {
   if (native === null) {
     throw new Error('Native module has not been initialized');
   }
-  return native.getNextFrame(maxWidth, maxHeight);
+  native.setPreviewFrameRate(maxFps);
 }
 
 function closePreviewChannel() {
@@ -126,10 +327,18 @@ module.exports = {
   initializeFfmpeg,
   createVideoOutput,
   queueNextFrame,
+  acquireFrameBuffer,
+  submitFrame,
   checkCompletedFrames,
+  getDroppedFrames,
+  getStats,
+  getEncoderProgress,
+  onFramesCompleted,
   closeVideoOutput,
   createPreviewChannel,
   openPreviewChannel,
   getNextFrame,
+  getNextFrameAsync,
+  setPreviewFrameRate,
   closePreviewChannel
 };
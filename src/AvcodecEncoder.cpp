@@ -0,0 +1,281 @@
+#include "AvcodecEncoder.h"
+#include "ColorConvert.h"
+#include <stdio.h>
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/dict.h>
+#include <libswscale/swscale.h>
+}
+
+using namespace std;
+
+AvcodecEncoder::AvcodecEncoder(uint32_t wid, uint32_t hgt, uint32_t rate, string encoder,
+    string path, VideoOptions opt) :
+  width(wid),
+  height(hgt),
+  fps(rate),
+  encoderName(encoder),
+  outputPath(path),
+  options(opt)
+{
+}
+
+AvcodecEncoder::~AvcodecEncoder()
+{
+  cleanUp();
+}
+
+string AvcodecEncoder::start()
+{
+  // Create the muxer, letting libavformat pick the container from the file extension
+  if (avformat_alloc_output_context2(&formatContext, NULL, NULL,
+    outputPath.c_str()) < 0)
+  {
+    return "Failed to create output context";
+  }
+  const AVCodec* codec = avcodec_find_encoder_by_name(encoderName.c_str());
+  if (codec == NULL)
+  {
+    return "Encoder not found";
+  }
+  stream = avformat_new_stream(formatContext, NULL);
+  codecContext = avcodec_alloc_context3(codec);
+  if ((stream == NULL) || (codecContext == NULL))
+  {
+    return "Failed to allocate encoder";
+  }
+
+  // Configure the encoder to match the arguments we pass to the ffmpeg process. A
+  // thread count of zero lets the encoder size its own thread pool
+  // Encoders such as libx264rgb and FFV1 keep the pixel format of the frames they're
+  // given, or the closest one they support, while the rest produce YUV 4:2:0
+  inputFormat = options.convertToYuv ? AV_PIX_FMT_YUV420P : AV_PIX_FMT_BGRA;
+  outputFormat = AV_PIX_FMT_YUV420P;
+  if (encoderoptions::outputPixelFormat(encoderName).empty())
+  {
+    outputFormat = inputFormat;
+    if (codec->pix_fmts != NULL)
+    {
+      outputFormat = avcodec_find_best_pix_fmt_of_list(codec->pix_fmts,
+        (AVPixelFormat)inputFormat, 0, NULL);
+    }
+  }
+  codecContext->width = width;
+  codecContext->height = height;
+  // Capture timestamps are passed through in microseconds, otherwise the time base is
+  // one frame
+  int timeScale = (options.timestamps == TIMESTAMPS_CAPTURE) ? 1000000 : (int)fps;
+  codecContext->time_base = AVRational{1, timeScale};
+  codecContext->framerate = AVRational{(int)fps, 1};
+  codecContext->pix_fmt = (AVPixelFormat)outputFormat;
+  codecContext->thread_count = 0;
+  codecContext->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+  if (options.convertToYuv)
+  {
+    bool bt709 = (options.colorMatrix == COLOR_MATRIX_BT709);
+    codecContext->colorspace = bt709 ? AVCOL_SPC_BT709 : AVCOL_SPC_SMPTE170M;
+    codecContext->color_primaries = bt709 ? AVCOL_PRI_BT709 : AVCOL_PRI_SMPTE170M;
+    codecContext->color_trc = bt709 ? AVCOL_TRC_BT709 : AVCOL_TRC_SMPTE170M;
+    codecContext->color_range = options.fullRange ? AVCOL_RANGE_JPEG : AVCOL_RANGE_MPEG;
+  }
+  if (formatContext->oformat->flags & AVFMT_GLOBALHEADER)
+  {
+    codecContext->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+  }
+
+  // Pass the encoder settings by name, the same way the ffmpeg process does
+  AVDictionary* codecOptions = NULL;
+  for (auto& option : encoderoptions::codecOptions(encoderName, options.encoderOptions))
+  {
+    av_dict_set(&codecOptions, option.first.c_str(), option.second.c_str(), 0);
+  }
+  int ret = avcodec_open2(codecContext, codec, &codecOptions);
+  if (av_dict_count(codecOptions) > 0)
+  {
+    printf("[AvcodecEncoder] Encoder ignored some of its options\n");
+  }
+  av_dict_free(&codecOptions);
+  if (ret < 0)
+  {
+    return "Failed to open encoder";
+  }
+  if (avcodec_parameters_from_context(stream->codecpar, codecContext) < 0)
+  {
+    return "Failed to configure stream";
+  }
+  stream->time_base = codecContext->time_base;
+
+  // Open the output file and write the container header
+  if (!(formatContext->oformat->flags & AVFMT_NOFILE))
+  {
+    if (avio_open(&formatContext->pb, outputPath.c_str(), AVIO_FLAG_WRITE) < 0)
+    {
+      return "Failed to open output file";
+    }
+  }
+  if (avformat_write_header(formatContext, NULL) < 0)
+  {
+    return "Failed to write header";
+  }
+  headerWritten = true;
+
+  // Frames that are already in the encoder's format are passed to it in place. Other
+  // frames are converted into a buffer owned by the frame
+  frame = av_frame_alloc();
+  packet = av_packet_alloc();
+  if ((frame == NULL) || (packet == NULL))
+  {
+    return "Failed to allocate frame";
+  }
+  frame->format = outputFormat;
+  frame->width = width;
+  frame->height = height;
+  if (inputFormat != outputFormat)
+  {
+    scaleContext = sws_getContext(width, height, (AVPixelFormat)inputFormat, width,
+      height, (AVPixelFormat)outputFormat, SWS_BILINEAR, NULL, NULL, NULL);
+    if ((scaleContext == NULL) || (av_frame_get_buffer(frame, 0) < 0))
+    {
+      return "Failed to create color converter";
+    }
+  }
+  return "";
+}
+
+bool AvcodecEncoder::writeFrame(uint8_t* data, uint32_t length,
+  int64_t timestamp)
+{
+  if (finished || (frame == NULL))
+  {
+    return false;
+  }
+
+  // Describe the planes of the incoming frame
+  uint8_t* planes[3] = {data, NULL, NULL};
+  int strides[3] = {(int)(width * 4), 0, 0};
+  if (options.convertToYuv)
+  {
+    if (length < colorconvert::yuv420Length(width, height))
+    {
+      return false;
+    }
+    uint32_t chromaWidth = width / 2, chromaHeight = height / 2;
+    planes[1] = data + width * height;
+    planes[2] = planes[1] + chromaWidth * chromaHeight;
+    strides[0] = width;
+    strides[1] = chromaWidth;
+    strides[2] = chromaWidth;
+  }
+  else if (length < width * height * 4)
+  {
+    return false;
+  }
+
+  if (scaleContext == NULL)
+  {
+    // Point the frame at the incoming planes. The frame isn't reference counted so the
+    // encoder copies it if it needs to keep it
+    for (uint32_t i = 0; i < 3; ++i)
+    {
+      frame->data[i] = planes[i];
+      frame->linesize[i] = strides[i];
+    }
+  }
+  else
+  {
+    // Convert the frame, making sure the encoder has let go of the last one
+    if (av_frame_make_writable(frame) < 0)
+    {
+      return false;
+    }
+    sws_scale(scaleContext, planes, strides, 0, height, frame->data, frame->linesize);
+  }
+
+  // Skipped frames leave gaps in the timestamps
+  frame->pts = (timestamp * codecContext->time_base.den + 500000) / 1000000;
+  if (avcodec_send_frame(codecContext, frame) < 0)
+  {
+    printf("[AvcodecEncoder] Failed to send frame to encoder\n");
+    return false;
+  }
+  return writePackets();
+}
+
+void AvcodecEncoder::finish()
+{
+  if (finished)
+  {
+    return;
+  }
+  finished = true;
+
+  // Drain the encoder and finalize the file
+  if ((codecContext != NULL) && (packet != NULL) && headerWritten)
+  {
+    avcodec_send_frame(codecContext, NULL);
+    writePackets();
+  }
+  if (headerWritten)
+  {
+    av_write_trailer(formatContext);
+  }
+  cleanUp();
+}
+
+bool AvcodecEncoder::writePackets()
+{
+  // Pass every packet the encoder has ready to the muxer
+  while (true)
+  {
+    int ret = avcodec_receive_packet(codecContext, packet);
+    if ((ret == AVERROR(EAGAIN)) || (ret == AVERROR_EOF))
+    {
+      return true;
+    }
+    if (ret < 0)
+    {
+      printf("[AvcodecEncoder] Failed to receive packet from encoder\n");
+      return false;
+    }
+    av_packet_rescale_ts(packet, codecContext->time_base, stream->time_base);
+    packet->stream_index = stream->index;
+    if (av_interleaved_write_frame(formatContext, packet) < 0)
+    {
+      printf("[AvcodecEncoder] Failed to write packet\n");
+      return false;
+    }
+  }
+}
+
+void AvcodecEncoder::cleanUp()
+{
+  if (scaleContext != NULL)
+  {
+    sws_freeContext(scaleContext);
+    scaleContext = NULL;
+  }
+  if (frame != NULL)
+  {
+    av_frame_free(&frame);
+  }
+  if (packet != NULL)
+  {
+    av_packet_free(&packet);
+  }
+  if (codecContext != NULL)
+  {
+    avcodec_free_context(&codecContext);
+  }
+  if (formatContext != NULL)
+  {
+    if (!(formatContext->oformat->flags & AVFMT_NOFILE))
+    {
+      avio_closep(&formatContext->pb);
+    }
+    avformat_free_context(formatContext);
+    formatContext = NULL;
+  }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include "VideoEncoder.h"
+#include "VideoOptions.h"
+
+struct AVCodecContext;
+struct AVFormatContext;
+struct AVFrame;
+struct AVPacket;
+struct AVStream;
+struct SwsContext;
+
+// This class encodes frames in-process with libavcodec and muxes them into the output
+// file with libavformat. Compared to the ffmpeg process, frames don't have to be
+// copied through a pipe and the encoder runs on its own pool of threads. It's only
+// compiled when the module is built with use_libav=1.
+class AvcodecEncoder : public VideoEncoder
+{
+public:
+  AvcodecEncoder(uint32_t width, uint32_t height, uint32_t fps, std::string encoder,
+    std::string outputPath, VideoOptions options);
+  virtual ~AvcodecEncoder();
+
+  std::string start();
+  bool writeFrame(uint8_t* data, uint32_t length, int64_t timestamp);
+  void finish();
+
+private:
+  bool writePackets();
+  void cleanUp();
+
+  uint32_t width;
+  uint32_t height;
+  uint32_t fps;
+  std::string encoderName;
+  std::string outputPath;
+  VideoOptions options;
+  AVFormatContext* formatContext = nullptr;
+  AVCodecContext* codecContext = nullptr;
+  AVStream* stream = nullptr;
+  AVFrame* frame = nullptr;
+  AVPacket* packet = nullptr;
+  SwsContext* scaleContext = nullptr;
+  int32_t inputFormat = 0;
+  int32_t outputFormat = 0;
+  bool headerWritten = false;
+  bool finished = false;
+};
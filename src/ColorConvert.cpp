@@ -0,0 +1,88 @@
+#include "ColorConvert.h"
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/utility.hpp>
+
+// Compile the baseline copy of the kernel
+#define KERNEL_NAMESPACE baseline
+#include "ColorConvert.simd.hpp"
+#undef KERNEL_NAMESPACE
+
+using namespace std;
+using namespace cv;
+
+// The AVX2 copy of the kernel is compiled separately with AVX2 enabled
+#ifdef EYE_NATIVE_AVX2
+namespace colorconvert
+{
+namespace avx2
+{
+  void bgraToYuv420Rows(const uint8_t* bgra, size_t stride, uint32_t width,
+    uint32_t firstPair, uint32_t lastPair, uint8_t* yPlane, uint8_t* uPlane,
+    uint8_t* vPlane, const YuvCoefficients& c);
+}
+}
+#endif
+
+// The number of row pairs that each parallel band converts
+#define ROW_PAIRS_PER_BAND 32
+
+static YuvCoefficients calculateCoefficients(uint32_t matrix, bool fullRange)
+{
+  // Start with the luma weights of the chosen matrix and derive the remaining terms
+  double kr = 0.299, kb = 0.114;
+  if (matrix == COLOR_MATRIX_BT709)
+  {
+    kr = 0.2126;
+    kb = 0.0722;
+  }
+  double kg = 1.0 - kr - kb;
+  double lumaScale = fullRange ? 1.0 : (219.0 / 255.0);
+  double chromaScale = fullRange ? 1.0 : (224.0 / 255.0);
+  double one = (double)(1 << COLOR_SHIFT);
+
+  YuvCoefficients c;
+  c.yr = (int32_t)lround(kr * lumaScale * one);
+  c.yg = (int32_t)lround(kg * lumaScale * one);
+  c.yb = (int32_t)lround(kb * lumaScale * one);
+  c.yOffset = ((fullRange ? 0 : 16) << COLOR_SHIFT) + (1 << (COLOR_SHIFT - 1));
+  c.ur = (int32_t)lround(-kr / (2.0 * (1.0 - kb)) * chromaScale * one);
+  c.ug = (int32_t)lround(-kg / (2.0 * (1.0 - kb)) * chromaScale * one);
+  c.ub = (int32_t)lround(0.5 * chromaScale * one);
+  c.vr = (int32_t)lround(0.5 * chromaScale * one);
+  c.vg = (int32_t)lround(-kg / (2.0 * (1.0 - kr)) * chromaScale * one);
+  c.vb = (int32_t)lround(-kb / (2.0 * (1.0 - kr)) * chromaScale * one);
+  return c;
+}
+
+size_t colorconvert::yuv420Length(uint32_t width, uint32_t height)
+{
+  return (size_t)width * height + 2 * ((size_t)(width / 2) * (height / 2));
+}
+
+void colorconvert::bgraToYuv420(const uint8_t* bgra, size_t stride, uint32_t width,
+  uint32_t height, uint8_t* yuv, uint32_t matrix, bool fullRange)
+{
+  YuvCoefficients c = calculateCoefficients(matrix, fullRange);
+  uint8_t* yPlane = yuv;
+  uint8_t* uPlane = yPlane + (size_t)width * height;
+  uint8_t* vPlane = uPlane + (size_t)(width / 2) * (height / 2);
+
+  // Pick the widest kernel the CPU supports
+  auto kernel = &baseline::bgraToYuv420Rows;
+#ifdef EYE_NATIVE_AVX2
+  if (checkHardwareSupport(CV_CPU_AVX2))
+  {
+    kernel = &avx2::bgraToYuv420Rows;
+  }
+#endif
+
+  // Split the frame into bands of rows and convert them in parallel
+  uint32_t pairs = height / 2;
+  uint32_t bands = (pairs + ROW_PAIRS_PER_BAND - 1) / ROW_PAIRS_PER_BAND;
+  parallel_for_(Range(0, bands), [&](const Range& range)
+  {
+    uint32_t firstPair = range.start * ROW_PAIRS_PER_BAND;
+    uint32_t lastPair = min(pairs, (uint32_t)range.end * ROW_PAIRS_PER_BAND);
+    kernel(bgra, stride, width, firstPair, lastPair, yPlane, uPlane, vPlane, c);
+  });
+}
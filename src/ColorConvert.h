@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// These functions convert BGRA frames to planar YUV 4:2:0, which is the format most
+// encoders consume. Doing the conversion here rather than in ffmpeg cuts the amount of
+// data written to the encoder from 4 bytes per pixel to 1.5 bytes per pixel. The
+// output consists of the full-resolution Y plane followed by the quarter-resolution U
+// and V planes, which is the layout of ffmpeg's yuv420p format.
+
+// Define constants for the supported color matrices
+#define COLOR_MATRIX_BT601 0
+#define COLOR_MATRIX_BT709 1
+
+// Coefficients are stored as fixed-point values with this many fractional bits
+#define COLOR_SHIFT 14
+
+// Centers the chroma values on 128 and rounds the sum of four pixels
+#define CHROMA_OFFSET ((128 << (COLOR_SHIFT + 2)) + (1 << (COLOR_SHIFT + 1)))
+
+typedef struct
+{
+  int32_t yr, yg, yb, yOffset;
+  int32_t ur, ug, ub;
+  int32_t vr, vg, vb;
+} YuvCoefficients;
+
+namespace colorconvert
+{
+  size_t yuv420Length(uint32_t width, uint32_t height);
+  void bgraToYuv420(const uint8_t* bgra, size_t stride, uint32_t width, uint32_t height,
+    uint8_t* yuv, uint32_t matrix, bool fullRange);
+}
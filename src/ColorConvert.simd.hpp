@@ -0,0 +1,147 @@
+// ColorConvert.simd.hpp: This file contains the BGRA to YUV 4:2:0 kernel. It's written
+// with OpenCV's universal intrinsics and is compiled once for the baseline instruction
+// set (SSE2 or NEON) and once for AVX2. The including file defines KERNEL_NAMESPACE
+// to keep the two copies apart.
+
+#include "ColorConvert.h"
+#include <opencv2/core/hal/intrin.hpp>
+
+namespace colorconvert
+{
+namespace KERNEL_NAMESPACE
+{
+  // Scalar conversion of the pixel pair at the given column in both rows
+  static inline void convertPairs(const uint8_t* src0, const uint8_t* src1,
+    uint32_t x, uint8_t* dstY0, uint8_t* dstY1, uint8_t* dstU, uint8_t* dstV,
+    const YuvCoefficients& c)
+  {
+    uint32_t sumB = 0, sumG = 0, sumR = 0;
+    const uint8_t* pixels[4] = {src0 + 4 * x, src0 + 4 * x + 4, src1 + 4 * x,
+      src1 + 4 * x + 4};
+    uint8_t* luma[4] = {dstY0 + x, dstY0 + x + 1, dstY1 + x, dstY1 + x + 1};
+    for (uint32_t i = 0; i < 4; ++i)
+    {
+      int32_t b = pixels[i][0], g = pixels[i][1], r = pixels[i][2];
+      *(luma[i]) = (uint8_t)((c.yb * b + c.yg * g + c.yr * r + c.yOffset) >>
+        COLOR_SHIFT);
+      sumB += b;
+      sumG += g;
+      sumR += r;
+    }
+    int32_t u = (c.ub * (int32_t)sumB + c.ug * (int32_t)sumG + c.ur * (int32_t)sumR +
+      CHROMA_OFFSET) >> (COLOR_SHIFT + 2);
+    int32_t v = (c.vb * (int32_t)sumB + c.vg * (int32_t)sumG + c.vr * (int32_t)sumR +
+      CHROMA_OFFSET) >> (COLOR_SHIFT + 2);
+    dstU[x / 2] = (uint8_t)((u < 0) ? 0 : ((u > 255) ? 255 : u));
+    dstV[x / 2] = (uint8_t)((v < 0) ? 0 : ((v > 255) ? 255 : v));
+  }
+
+#if CV_SIMD
+  // Calculates the luma of each pixel in a vector using pairwise multiply-adds
+  static inline cv::v_uint8 convertLuma(const cv::v_uint8& b, const cv::v_uint8& g,
+    const cv::v_uint8& r, const cv::v_int16& coefBG, const cv::v_int16& coefR,
+    const cv::v_int32& offset)
+  {
+    using namespace cv;
+    v_uint16 zero = vx_setzero_u16();
+    v_uint16 b16[2], g16[2], r16[2];
+    v_expand(b, b16[0], b16[1]);
+    v_expand(g, g16[0], g16[1]);
+    v_expand(r, r16[0], r16[1]);
+    v_int16 luma[2];
+    for (int i = 0; i < 2; ++i)
+    {
+      v_uint16 bg0, bg1, r0, r1;
+      v_zip(b16[i], g16[i], bg0, bg1);
+      v_zip(r16[i], zero, r0, r1);
+      v_int32 y0 = v_dotprod(v_reinterpret_as_s16(bg0), coefBG,
+        v_dotprod(v_reinterpret_as_s16(r0), coefR, offset));
+      v_int32 y1 = v_dotprod(v_reinterpret_as_s16(bg1), coefBG,
+        v_dotprod(v_reinterpret_as_s16(r1), coefR, offset));
+      luma[i] = v_pack(v_shr<COLOR_SHIFT>(y0), v_shr<COLOR_SHIFT>(y1));
+    }
+    return v_pack_u(luma[0], luma[1]);
+  }
+
+  // Adds each pair of neighboring 16-bit lanes into a 32-bit lane
+  static inline cv::v_int32 sumPairs(const cv::v_uint16& value)
+  {
+    using namespace cv;
+    v_uint32 pairs = v_reinterpret_as_u32(value);
+    return v_reinterpret_as_s32((pairs & vx_setall_u32(0xFFFF)) + (pairs >> 16));
+  }
+
+  // Calculates one chroma component from the summed channels of 2x2 pixel blocks
+  static inline cv::v_int16 convertChroma(const cv::v_int32* sumB,
+    const cv::v_int32* sumG, const cv::v_int32* sumR, int32_t cb, int32_t cg,
+    int32_t cr)
+  {
+    using namespace cv;
+    v_int32 coefB = vx_setall_s32(cb), coefG = vx_setall_s32(cg),
+      coefR = vx_setall_s32(cr), offset = vx_setall_s32(CHROMA_OFFSET);
+    v_int32 c0 = sumB[0] * coefB + sumG[0] * coefG + sumR[0] * coefR + offset;
+    v_int32 c1 = sumB[1] * coefB + sumG[1] * coefG + sumR[1] * coefR + offset;
+    return v_pack(v_shr<COLOR_SHIFT + 2>(c0), v_shr<COLOR_SHIFT + 2>(c1));
+  }
+#endif
+
+  void bgraToYuv420Rows(const uint8_t* bgra, size_t stride, uint32_t width,
+    uint32_t firstPair, uint32_t lastPair, uint8_t* yPlane, uint8_t* uPlane,
+    uint8_t* vPlane, const YuvCoefficients& c)
+  {
+#if CV_SIMD
+    using namespace cv;
+    const uint32_t lanes = v_uint8::nlanes;
+    v_int16 coefBG = v_reinterpret_as_s16(vx_setall_s32((c.yg << 16) |
+      (c.yb & 0xFFFF)));
+    v_int16 coefR = v_reinterpret_as_s16(vx_setall_s32(c.yr & 0xFFFF));
+    v_int32 lumaOffset = vx_setall_s32(c.yOffset);
+#endif
+    for (uint32_t pair = firstPair; pair < lastPair; ++pair)
+    {
+      const uint8_t* src0 = bgra + (2 * pair) * stride;
+      const uint8_t* src1 = src0 + stride;
+      uint8_t* dstY0 = yPlane + (size_t)(2 * pair) * width;
+      uint8_t* dstY1 = dstY0 + width;
+      uint8_t* dstU = uPlane + (size_t)pair * (width / 2);
+      uint8_t* dstV = vPlane + (size_t)pair * (width / 2);
+      uint32_t x = 0;
+#if CV_SIMD
+      for (; x + lanes <= width; x += lanes)
+      {
+        v_uint8 b0, g0, r0, a0, b1, g1, r1, a1;
+        v_load_deinterleave(src0 + 4 * x, b0, g0, r0, a0);
+        v_load_deinterleave(src1 + 4 * x, b1, g1, r1, a1);
+        v_store(dstY0 + x, convertLuma(b0, g0, r0, coefBG, coefR, lumaOffset));
+        v_store(dstY1 + x, convertLuma(b1, g1, r1, coefBG, coefR, lumaOffset));
+
+        // Sum each 2x2 block of pixels for the chroma planes
+        v_uint16 lo0, hi0, lo1, hi1;
+        v_int32 sumB[2], sumG[2], sumR[2];
+        v_expand(b0, lo0, hi0);
+        v_expand(b1, lo1, hi1);
+        sumB[0] = sumPairs(lo0 + lo1);
+        sumB[1] = sumPairs(hi0 + hi1);
+        v_expand(g0, lo0, hi0);
+        v_expand(g1, lo1, hi1);
+        sumG[0] = sumPairs(lo0 + lo1);
+        sumG[1] = sumPairs(hi0 + hi1);
+        v_expand(r0, lo0, hi0);
+        v_expand(r1, lo1, hi1);
+        sumR[0] = sumPairs(lo0 + lo1);
+        sumR[1] = sumPairs(hi0 + hi1);
+        v_pack_u_store(dstU + x / 2, convertChroma(sumB, sumG, sumR, c.ub, c.ug, c.ur));
+        v_pack_u_store(dstV + x / 2, convertChroma(sumB, sumG, sumR, c.vb, c.vg, c.vr));
+      }
+#endif
+      for (; x < width; x += 2)
+      {
+        convertPairs(src0, src1, x, dstY0, dstY1, dstU, dstV, c);
+      }
+    }
+#if CV_SIMD
+    vx_cleanup();
+#endif
+  }
+}
+}
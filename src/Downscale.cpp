@@ -0,0 +1,86 @@
+#include "Downscale.h"
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/utility.hpp>
+
+// Compile the baseline copy of the kernels
+#define KERNEL_NAMESPACE baseline
+#include "Downscale.simd.hpp"
+#undef KERNEL_NAMESPACE
+
+using namespace std;
+using namespace cv;
+
+// The AVX2 copy of the kernels is compiled separately with AVX2 enabled
+#ifdef EYE_NATIVE_AVX2
+namespace downscale
+{
+namespace avx2
+{
+  void bgraRows(const uint8_t* src, size_t srcStride, uint8_t* dst, size_t dstStride,
+    uint32_t dstWidth, uint32_t firstRow, uint32_t lastRow, uint32_t factor);
+}
+}
+#endif
+
+// The number of output rows that each parallel band produces
+#define ROWS_PER_BAND 32
+
+void downscale::fitWithin(uint32_t srcWidth, uint32_t srcHeight, uint32_t maxWidth,
+  uint32_t maxHeight, uint32_t& width, uint32_t& height)
+{
+  // Use the standard approach to calculate the largest size with the same aspect ratio
+  // that fits inside the maximum size
+  double frameRatio = (double)srcWidth / (double)srcHeight;
+  double maxRatio = (double)maxWidth / (double)maxHeight;
+  if (frameRatio > maxRatio)
+  {
+    width = maxWidth;
+    height = (uint32_t)((double)srcHeight * (double)maxWidth / (double)srcWidth);
+  }
+  else
+  {
+    height = maxHeight;
+    width = (uint32_t)((double)srcWidth * (double)maxHeight / (double)srcHeight);
+  }
+}
+
+uint32_t downscale::integerFactor(uint32_t srcWidth, uint32_t srcHeight,
+  uint32_t dstWidth, uint32_t dstHeight)
+{
+  // Return the factor if the source is an exact multiple of the destination in both
+  // directions and zero otherwise
+  if ((dstWidth == 0) || (dstHeight == 0))
+  {
+    return 0;
+  }
+  for (uint32_t factor = DOWNSCALE_MIN_FACTOR; factor <= DOWNSCALE_MAX_FACTOR; ++factor)
+  {
+    if ((srcWidth == dstWidth * factor) && (srcHeight == dstHeight * factor))
+    {
+      return factor;
+    }
+  }
+  return 0;
+}
+
+void downscale::bgra(const uint8_t* src, size_t srcStride, uint8_t* dst,
+  size_t dstStride, uint32_t dstWidth, uint32_t dstHeight, uint32_t factor)
+{
+  // Pick the widest kernel the CPU supports
+  auto kernel = &baseline::bgraRows;
+#ifdef EYE_NATIVE_AVX2
+  if (checkHardwareSupport(CV_CPU_AVX2))
+  {
+    kernel = &avx2::bgraRows;
+  }
+#endif
+
+  // Split the frame into bands of rows and shrink them in parallel
+  uint32_t bands = (dstHeight + ROWS_PER_BAND - 1) / ROWS_PER_BAND;
+  parallel_for_(Range(0, bands), [&](const Range& range)
+  {
+    uint32_t firstRow = range.start * ROWS_PER_BAND;
+    uint32_t lastRow = min(dstHeight, (uint32_t)range.end * ROWS_PER_BAND);
+    kernel(src, srcStride, dst, dstStride, dstWidth, firstRow, lastRow, factor);
+  });
+}
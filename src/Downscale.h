@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// These functions shrink BGRA frames by a whole-number factor by averaging each block
+// of factor x factor pixels. Captures from HiDPI displays are almost always an exact
+// multiple of the stimulus size, and these kernels are considerably faster than the
+// general-purpose OpenCV resize for that case.
+
+// The supported scaling factors
+#define DOWNSCALE_MIN_FACTOR 2
+#define DOWNSCALE_MAX_FACTOR 4
+
+namespace downscale
+{
+  void fitWithin(uint32_t srcWidth, uint32_t srcHeight, uint32_t maxWidth,
+    uint32_t maxHeight, uint32_t& width, uint32_t& height);
+  uint32_t integerFactor(uint32_t srcWidth, uint32_t srcHeight, uint32_t dstWidth,
+    uint32_t dstHeight);
+  void bgra(const uint8_t* src, size_t srcStride, uint8_t* dst, size_t dstStride,
+    uint32_t dstWidth, uint32_t dstHeight, uint32_t factor);
+}
@@ -0,0 +1,134 @@
+// Downscale.simd.hpp: This file contains the integer-factor BGRA downscale kernels.
+// Like ColorConvert.simd.hpp it's compiled once for the baseline instruction set and
+// once for AVX2, with the including file defining KERNEL_NAMESPACE.
+
+#include "Downscale.h"
+#include <opencv2/core/hal/intrin.hpp>
+
+namespace downscale
+{
+namespace KERNEL_NAMESPACE
+{
+  // Scalar version of the kernel for the pixels at the end of each row
+  template <int F>
+  static inline void averagePixel(const uint8_t* src, size_t srcStride, uint8_t* dst)
+  {
+    for (int channel = 0; channel < 4; ++channel)
+    {
+      uint32_t sum = 0;
+      for (int row = 0; row < F; ++row)
+      {
+        for (int column = 0; column < F; ++column)
+        {
+          sum += src[row * srcStride + column * 4 + channel];
+        }
+      }
+      dst[channel] = (uint8_t)((sum + (F * F) / 2) / (F * F));
+    }
+  }
+
+#if CV_SIMD
+  // Loads F consecutive groups of pixels and separates them so that each vector holds
+  // the pixels at the same position within their block
+  static inline void loadColumns(const uint8_t* src, cv::v_uint32* columns,
+    std::integral_constant<int, 2>)
+  {
+    cv::v_load_deinterleave((const unsigned*)src, columns[0], columns[1]);
+  }
+  static inline void loadColumns(const uint8_t* src, cv::v_uint32* columns,
+    std::integral_constant<int, 3>)
+  {
+    cv::v_load_deinterleave((const unsigned*)src, columns[0], columns[1], columns[2]);
+  }
+  static inline void loadColumns(const uint8_t* src, cv::v_uint32* columns,
+    std::integral_constant<int, 4>)
+  {
+    cv::v_load_deinterleave((const unsigned*)src, columns[0], columns[1], columns[2],
+      columns[3]);
+  }
+
+  // Divides the summed channels by the number of pixels in each block
+  static inline cv::v_uint8 divideSums(const cv::v_uint16& lo, const cv::v_uint16& hi,
+    std::integral_constant<int, 2>)
+  {
+    return cv::v_rshr_pack<2>(lo, hi);
+  }
+  static inline cv::v_uint8 divideSums(const cv::v_uint16& lo, const cv::v_uint16& hi,
+    std::integral_constant<int, 3>)
+  {
+    // Multiply by 65536 / 9 and keep the high half. This is exact for every sum that
+    // nine 8-bit values can produce
+    using namespace cv;
+    v_uint16 round = vx_setall_u16(4), scale = vx_setall_u16(7282);
+    return v_pack(v_mul_hi(lo + round, scale), v_mul_hi(hi + round, scale));
+  }
+  static inline cv::v_uint8 divideSums(const cv::v_uint16& lo, const cv::v_uint16& hi,
+    std::integral_constant<int, 4>)
+  {
+    return cv::v_rshr_pack<4>(lo, hi);
+  }
+#endif
+
+  template <int F>
+  static void downscaleRows(const uint8_t* src, size_t srcStride, uint8_t* dst,
+    size_t dstStride, uint32_t dstWidth, uint32_t firstRow, uint32_t lastRow)
+  {
+#if CV_SIMD
+    using namespace cv;
+    const uint32_t lanes = v_uint32::nlanes;
+    std::integral_constant<int, F> factor;
+#endif
+    for (uint32_t y = firstRow; y < lastRow; ++y)
+    {
+      const uint8_t* srcRow = src + (size_t)y * F * srcStride;
+      uint8_t* dstRow = dst + (size_t)y * dstStride;
+      uint32_t x = 0;
+#if CV_SIMD
+      for (; x + lanes <= dstWidth; x += lanes)
+      {
+        // Accumulate every pixel in each block as 16-bit channel values. The largest
+        // possible sum of 16 pixels fits comfortably
+        v_uint16 sumLo = vx_setzero_u16(), sumHi = vx_setzero_u16();
+        for (int row = 0; row < F; ++row)
+        {
+          v_uint32 columns[F];
+          loadColumns(srcRow + row * srcStride + (size_t)x * F * 4, columns, factor);
+          for (int column = 0; column < F; ++column)
+          {
+            v_uint16 lo, hi;
+            v_expand(v_reinterpret_as_u8(columns[column]), lo, hi);
+            sumLo += lo;
+            sumHi += hi;
+          }
+        }
+        v_store(dstRow + x * 4, divideSums(sumLo, sumHi, factor));
+      }
+#endif
+      for (; x < dstWidth; ++x)
+      {
+        averagePixel<F>(srcRow + (size_t)x * F * 4, srcStride, dstRow + x * 4);
+      }
+    }
+#if CV_SIMD
+    vx_cleanup();
+#endif
+  }
+
+  void bgraRows(const uint8_t* src, size_t srcStride, uint8_t* dst, size_t dstStride,
+    uint32_t dstWidth, uint32_t firstRow, uint32_t lastRow, uint32_t factor)
+  {
+    switch (factor)
+    {
+      case 2:
+        downscaleRows<2>(src, srcStride, dst, dstStride, dstWidth, firstRow, lastRow);
+        break;
+      case 3:
+        downscaleRows<3>(src, srcStride, dst, dstStride, dstWidth, firstRow, lastRow);
+        break;
+      case 4:
+        downscaleRows<4>(src, srcStride, dst, dstStride, dstWidth, firstRow, lastRow);
+        break;
+    }
+  }
+}
+}
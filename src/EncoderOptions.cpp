@@ -0,0 +1,386 @@
+#include "EncoderOptions.h"
+#include <algorithm>
+
+using namespace std;
+
+// Define constants for the families of encoders that take the same settings
+#define ENCODER_FAMILY_OTHER 0
+#define ENCODER_FAMILY_X264 1
+#define ENCODER_FAMILY_X264RGB 2
+#define ENCODER_FAMILY_X265 3
+#define ENCODER_FAMILY_NVENC 4
+#define ENCODER_FAMILY_VIDEOTOOLBOX 5
+#define ENCODER_FAMILY_FFV1 6
+#define ENCODER_FAMILY_MPEG4 7
+#define ENCODER_FAMILY_VPX 8
+
+static const vector<string> x264Presets = {"ultrafast", "superfast", "veryfast", "faster",
+  "fast", "medium", "slow", "slower", "veryslow", "placebo"};
+static const vector<string> x264Tunes = {"film", "animation", "grain", "stillimage",
+  "fastdecode", "zerolatency", "psnr", "ssim"};
+static const vector<string> x265Tunes = {"animation", "grain", "fastdecode",
+  "zerolatency", "psnr", "ssim"};
+static const vector<string> nvencPresets = {"p1", "p2", "p3", "p4", "p5", "p6", "p7",
+  "default", "slow", "medium", "fast", "hp", "hq", "bd", "ll", "llhq", "llhp",
+  "lossless", "losslesshp"};
+static const vector<string> nvencTunes = {"hq", "ll", "ull", "lossless"};
+static const vector<string> vpxPresets = {"good", "best", "realtime"};
+
+static bool endsWith(const string& value, const string& suffix)
+{
+  return (value.size() >= suffix.size()) &&
+    (value.compare(value.size() - suffix.size(), suffix.size(), suffix) == 0);
+}
+
+static bool contains(const vector<string>& values, const string& value)
+{
+  return (find(values.begin(), values.end(), value) != values.end());
+}
+
+static uint32_t encoderFamily(const string& encoder)
+{
+  if (encoder == "libx264")
+  {
+    return ENCODER_FAMILY_X264;
+  }
+  if (encoder == "libx264rgb")
+  {
+    return ENCODER_FAMILY_X264RGB;
+  }
+  if (encoder == "libx265")
+  {
+    return ENCODER_FAMILY_X265;
+  }
+  if (endsWith(encoder, "_nvenc"))
+  {
+    return ENCODER_FAMILY_NVENC;
+  }
+  if (endsWith(encoder, "_videotoolbox"))
+  {
+    return ENCODER_FAMILY_VIDEOTOOLBOX;
+  }
+  if (encoder == "ffv1")
+  {
+    return ENCODER_FAMILY_FFV1;
+  }
+  if ((encoder == "mpeg4") || (encoder == "libxvid"))
+  {
+    return ENCODER_FAMILY_MPEG4;
+  }
+  if ((encoder == "libvpx") || (encoder == "libvpx-vp9"))
+  {
+    return ENCODER_FAMILY_VPX;
+  }
+  return ENCODER_FAMILY_OTHER;
+}
+
+// Returns the settings that make up a named profile for the given family
+static string profileSettings(uint32_t family, const string& profile,
+  EncoderOptions& settings)
+{
+  bool x26x = (family == ENCODER_FAMILY_X264) || (family == ENCODER_FAMILY_X264RGB) ||
+    (family == ENCODER_FAMILY_X265);
+  if (profile == "realtime-fast")
+  {
+    // Favor speed and latency over file size
+    if (x26x)
+    {
+      settings.preset = "ultrafast";
+      settings.tune = "zerolatency";
+    }
+    else if (family == ENCODER_FAMILY_NVENC)
+    {
+      settings.preset = "p1";
+      settings.tune = "ull";
+    }
+    else if (family == ENCODER_FAMILY_VPX)
+    {
+      settings.preset = "realtime";
+    }
+  }
+  else if (profile == "balanced")
+  {
+    // Use the encoder's own middle ground
+    if (x26x)
+    {
+      settings.preset = "medium";
+      settings.crf = (family == ENCODER_FAMILY_X265) ? 28 : 23;
+    }
+    else if (family == ENCODER_FAMILY_NVENC)
+    {
+      settings.preset = "p4";
+      settings.tune = "hq";
+    }
+    else if (family == ENCODER_FAMILY_VPX)
+    {
+      settings.preset = "good";
+      settings.crf = 31;
+    }
+  }
+  else if (profile == "archival-lossless")
+  {
+    settings.lossless = true;
+    if (x26x)
+    {
+      settings.preset = "medium";
+    }
+    else if (family == ENCODER_FAMILY_NVENC)
+    {
+      settings.preset = "p7";
+    }
+    else if (family == ENCODER_FAMILY_VPX)
+    {
+      settings.preset = "good";
+    }
+  }
+  else
+  {
+    return "Unsupported encoder profile";
+  }
+  return "";
+}
+
+string encoderoptions::resolve(string encoder, EncoderOptions& options)
+{
+  uint32_t family = encoderFamily(encoder);
+
+  // Fill in any settings the caller didn't give from the named profile
+  if (!options.profile.empty())
+  {
+    EncoderOptions settings;
+    string error = profileSettings(family, options.profile, settings);
+    if (!error.empty())
+    {
+      return error;
+    }
+    if (options.preset.empty())
+    {
+      options.preset = settings.preset;
+    }
+    if ((options.crf < 0) && (options.bitrate == 0) && !options.lossless)
+    {
+      options.crf = settings.crf;
+    }
+    if (options.tune.empty())
+    {
+      options.tune = settings.tune;
+    }
+    options.lossless = options.lossless || settings.lossless;
+  }
+
+  // Check the settings against what the family supports
+  bool x26x = (family == ENCODER_FAMILY_X264) || (family == ENCODER_FAMILY_X264RGB) ||
+    (family == ENCODER_FAMILY_X265);
+  if (!options.preset.empty())
+  {
+    bool valid = false;
+    if (x26x)
+    {
+      valid = contains(x264Presets, options.preset);
+    }
+    else if (family == ENCODER_FAMILY_NVENC)
+    {
+      valid = contains(nvencPresets, options.preset);
+    }
+    else if (family == ENCODER_FAMILY_VPX)
+    {
+      valid = contains(vpxPresets, options.preset);
+    }
+    else
+    {
+      return "Encoder does not support presets";
+    }
+    if (!valid)
+    {
+      return "Unsupported preset for encoder";
+    }
+  }
+  if (!options.tune.empty())
+  {
+    bool valid = false;
+    if ((family == ENCODER_FAMILY_X264) || (family == ENCODER_FAMILY_X264RGB))
+    {
+      valid = contains(x264Tunes, options.tune);
+    }
+    else if (family == ENCODER_FAMILY_X265)
+    {
+      valid = contains(x265Tunes, options.tune);
+    }
+    else if (family == ENCODER_FAMILY_NVENC)
+    {
+      valid = contains(nvencTunes, options.tune);
+    }
+    else
+    {
+      return "Encoder does not support tuning";
+    }
+    if (!valid)
+    {
+      return "Unsupported tune for encoder";
+    }
+  }
+  if (options.crf >= 0)
+  {
+    // NVENC treats a constant quality of zero as automatic so it starts at one
+    int32_t minCrf = (family == ENCODER_FAMILY_NVENC) ? 1 : 0;
+    int32_t maxCrf = 51;
+    if (family == ENCODER_FAMILY_VPX)
+    {
+      maxCrf = 63;
+    }
+    else if (!x26x && (family != ENCODER_FAMILY_NVENC))
+    {
+      return "Encoder does not support crf";
+    }
+    if ((options.crf < minCrf) || (options.crf > maxCrf))
+    {
+      return "Crf is out of range for encoder";
+    }
+    if ((options.bitrate != 0) && (family != ENCODER_FAMILY_VPX))
+    {
+      return "Crf and bitrate can't be combined for encoder";
+    }
+  }
+  if ((options.bitrate != 0) && (family == ENCODER_FAMILY_FFV1))
+  {
+    return "Encoder does not support bitrate";
+  }
+  if ((options.slices != 0) && (family != ENCODER_FAMILY_X264) &&
+    (family != ENCODER_FAMILY_X264RGB) && (family != ENCODER_FAMILY_FFV1))
+  {
+    return "Encoder does not support slices";
+  }
+  if (options.lossless)
+  {
+    // Only the VP9 encoder in the libvpx family has a lossless mode
+    if (!x26x && (family != ENCODER_FAMILY_NVENC) && (family != ENCODER_FAMILY_FFV1) &&
+      (encoder != "libvpx-vp9"))
+    {
+      return "Encoder does not support lossless encoding";
+    }
+    if ((options.crf >= 0) || (options.bitrate != 0))
+    {
+      return "Lossless encoding can't be combined with crf or bitrate";
+    }
+
+    // NVENC selects lossless mode through its tuning
+    if (family == ENCODER_FAMILY_NVENC)
+    {
+      if (!options.tune.empty() && (options.tune != "lossless"))
+      {
+        return "Lossless encoding can't be combined with tune for encoder";
+      }
+      options.tune = "lossless";
+    }
+  }
+  return "";
+}
+
+vector<pair<string, string>> encoderoptions::codecOptions(string encoder,
+  const EncoderOptions& options)
+{
+  uint32_t family = encoderFamily(encoder);
+  vector<pair<string, string>> ret;
+
+  // H.264 encoders default to the high profile, except when lossless, which needs one
+  // of the 4:4:4 profiles. x264 is lossless when crf is zero
+  bool h264 = (family == ENCODER_FAMILY_X264) || (encoder == "h264_nvenc") ||
+    (encoder == "h264_videotoolbox") ||
+    ((family == ENCODER_FAMILY_OTHER) && (encoder.compare(0, 5, "h264_") == 0));
+  if (h264)
+  {
+    bool lossless = options.lossless ||
+      ((family == ENCODER_FAMILY_X264) && (options.crf == 0));
+    if (!lossless)
+    {
+      ret.push_back({"profile", "high"});
+    }
+    else if (family == ENCODER_FAMILY_X264)
+    {
+      ret.push_back({"profile", "high444"});
+    }
+    else if (family == ENCODER_FAMILY_NVENC)
+    {
+      ret.push_back({"profile", "high444p"});
+    }
+  }
+
+  // libvpx calls its preset the deadline and NVENC calls constant quality cq
+  if (!options.preset.empty())
+  {
+    ret.push_back({(family == ENCODER_FAMILY_VPX) ? "deadline" : "preset",
+      options.preset});
+  }
+  if (!options.tune.empty())
+  {
+    ret.push_back({"tune", options.tune});
+  }
+  if (options.crf >= 0)
+  {
+    if (family == ENCODER_FAMILY_NVENC)
+    {
+      ret.push_back({"rc", "vbr"});
+      ret.push_back({"cq", to_string(options.crf)});
+    }
+    else
+    {
+      ret.push_back({"crf", to_string(options.crf)});
+    }
+
+    // libvpx only uses constant quality when the bitrate is zero, otherwise it treats
+    // the bitrate as a cap
+    if ((family == ENCODER_FAMILY_VPX) && (options.bitrate == 0))
+    {
+      ret.push_back({"b", "0"});
+    }
+  }
+  if (options.bitrate != 0)
+  {
+    ret.push_back({"b", to_string(options.bitrate) + "k"});
+  }
+  if (options.lossless)
+  {
+    if ((family == ENCODER_FAMILY_X264) || (family == ENCODER_FAMILY_X264RGB))
+    {
+      ret.push_back({"qp", "0"});
+    }
+    else if (family == ENCODER_FAMILY_X265)
+    {
+      ret.push_back({"x265-params", "lossless=1"});
+    }
+    else if (encoder == "libvpx-vp9")
+    {
+      ret.push_back({"lossless", "1"});
+    }
+  }
+  if (options.gop != 0)
+  {
+    ret.push_back({"g", to_string(options.gop)});
+  }
+  if (options.threads >= 0)
+  {
+    ret.push_back({"threads", to_string(options.threads)});
+  }
+  if (options.slices != 0)
+  {
+    // FFV1 only supports slices in version 3 of the format
+    if (family == ENCODER_FAMILY_FFV1)
+    {
+      ret.push_back({"level", "3"});
+    }
+    ret.push_back({"slices", to_string(options.slices)});
+  }
+  return ret;
+}
+
+string encoderoptions::outputPixelFormat(string encoder)
+{
+  // libx264rgb only accepts RGB input and FFV1 is lossless, so both keep the format
+  // of the frames they're given. Everything else produces widely compatible 4:2:0
+  uint32_t family = encoderFamily(encoder);
+  if ((family == ENCODER_FAMILY_X264RGB) || (family == ENCODER_FAMILY_FFV1))
+  {
+    return "";
+  }
+  return "yuv420p";
+}
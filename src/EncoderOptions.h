@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// These settings control the trade-off between quality, file size and speed. Each one
+// is optional, and a named profile fills in any settings that weren't given. They're
+// validated against the family of the chosen encoder because the encoders differ in
+// which settings they accept and what values are allowed.
+typedef struct
+{
+  // One of "realtime-fast", "balanced" or "archival-lossless"
+  std::string profile;
+
+  // The encoder's speed preset, such as "veryfast" for libx264 or "p4" for NVENC
+  std::string preset;
+
+  // Constant quality mode. Lower values give better quality. Negative means unset
+  int32_t crf = -1;
+
+  // The target bitrate in kilobits per second. Zero means unset
+  uint32_t bitrate = 0;
+
+  // The maximum number of frames between key frames. Zero means unset
+  uint32_t gop = 0;
+
+  // The number of encoder threads. Zero lets the encoder decide, negative means unset
+  int32_t threads = -1;
+
+  // The encoder's tuning, such as "zerolatency"
+  std::string tune;
+
+  // Split each frame into this many slices that are encoded in parallel. Zero means
+  // unset
+  uint32_t slices = 0;
+
+  // Encode without any loss relative to the frames passed to the encoder
+  bool lossless = false;
+} EncoderOptions;
+
+namespace encoderoptions
+{
+  // Applies the named profile and checks the settings against the encoder. Returns an
+  // error message if the encoder doesn't support them
+  std::string resolve(std::string encoder, EncoderOptions& options);
+
+  // Translates the settings into the names and values of the encoder's AVOptions,
+  // which are used by both the ffmpeg command line and libavcodec
+  std::vector<std::pair<std::string, std::string>> codecOptions(std::string encoder,
+    const EncoderOptions& options);
+
+  // Returns the pixel format that the encoder should produce or an empty string if it
+  // should keep the format of its input
+  std::string outputPixelFormat(std::string encoder);
+}
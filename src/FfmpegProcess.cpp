@@ -1,13 +1,21 @@
 #include "FfmpegProcess.h"
+#include "Matroska.h"
 #include "Platform.h"
 #include <stdexcept>
 
 using namespace std;
 
-FfmpegProcess::FfmpegProcess(string exec, uint32_t width, uint32_t height, uint32_t fps,
-    string encoder, string outputPath) :
+FfmpegProcess::FfmpegProcess(string exec, uint32_t wid, uint32_t hgt, uint32_t rate,
+    string encoder, string outputPath, VideoOptions options) :
   Thread("ffmpeg"),
-  executable(exec)
+  executable(exec),
+  width(wid),
+  height(hgt),
+  fps(rate),
+  convertToYuv(options.convertToYuv),
+  timestamped(options.elideDuplicates || (options.timestamps == TIMESTAMPS_CAPTURE)),
+  reportsProgress(true),
+  framesWritten(0)
 {
   // Check options using:
   //   ffmpeg -h encoder=h264_videotoolbox
@@ -15,19 +23,37 @@ FfmpegProcess::FfmpegProcess(string exec, uint32_t width, uint32_t height, uint3
 
   // ffmpeg -f rawvideo -pix_fmt rgb24 -vf scale=960x720 1920x1080 -framerate 30 -i pipe:0
   // -c:v h264_videotoolbox -profile:v high -pix_fmt yuv420p -y output.mp4
+  //
+  // The encoder arguments come from the encoder options, which have already been
+  // checked against the encoder by encoderoptions::resolve()
 
-  // Input options
-  arguments.push_back("-f");
-  arguments.push_back("rawvideo");
+  // Report progress as key=value lines on stdout instead of the status line on
+  // stderr, which leaves stderr for errors
+  arguments.push_back("-progress");
+  arguments.push_back("pipe:1");
+  arguments.push_back("-nostats");
 
-  arguments.push_back("-pix_fmt");
-  arguments.push_back("bgra");
+  // Input options. Frames are sent as raw video at a constant frame rate unless they
+  // need timestamps, in which case they're wrapped in a Matroska stream
+  if (timestamped)
+  {
+    arguments.push_back("-f");
+    arguments.push_back("matroska");
+  }
+  else
+  {
+    arguments.push_back("-f");
+    arguments.push_back("rawvideo");
 
-  arguments.push_back("-video_size");
-  arguments.push_back(to_string(width) + "x" + to_string(height));
+    arguments.push_back("-pix_fmt");
+    arguments.push_back(options.convertToYuv ? "yuv420p" : "bgra");
 
-  arguments.push_back("-framerate");
-  arguments.push_back(to_string(fps));
+    arguments.push_back("-video_size");
+    arguments.push_back(to_string(width) + "x" + to_string(height));
+
+    arguments.push_back("-framerate");
+    arguments.push_back(to_string(fps));
+  }
 
   arguments.push_back("-i");
   arguments.push_back("pipe:0");
@@ -36,14 +62,45 @@ FfmpegProcess::FfmpegProcess(string exec, uint32_t width, uint32_t height, uint3
   //arguments.push_back("-vf");
   //arguments.push_back("scale=" + to_string(width) + "x" + to_string(height));
 
+  // Keep the input timestamps rather than duplicating frames to fill the gaps
+  if (timestamped)
+  {
+    arguments.push_back("-vsync");
+    arguments.push_back("vfr");
+  }
+
   arguments.push_back("-c:v");
   arguments.push_back(encoder);
 
-  arguments.push_back("-profile:v");
-  arguments.push_back("high");
+  // Pass the encoder settings as options for the video stream
+  for (auto& option : encoderoptions::codecOptions(encoder, options.encoderOptions))
+  {
+    arguments.push_back("-" + option.first + ":v");
+    arguments.push_back(option.second);
+  }
+
+  string pixelFormat = encoderoptions::outputPixelFormat(encoder);
+  if (!pixelFormat.empty())
+  {
+    arguments.push_back("-pix_fmt");
+    arguments.push_back(pixelFormat);
+  }
 
-  arguments.push_back("-pix_fmt");
-  arguments.push_back("yuv420p");
+  // Tag the output with the color matrix and range that the frame thread uses to
+  // convert frames
+  if (options.convertToYuv)
+  {
+    string colorSpace = (options.colorMatrix == COLOR_MATRIX_BT709) ? "bt709" :
+      "smpte170m";
+    arguments.push_back("-colorspace");
+    arguments.push_back(colorSpace);
+    arguments.push_back("-color_primaries");
+    arguments.push_back(colorSpace);
+    arguments.push_back("-color_trc");
+    arguments.push_back(colorSpace);
+    arguments.push_back("-color_range");
+    arguments.push_back(options.fullRange ? "pc" : "tv");
+  }
 
   arguments.push_back("-y");
   arguments.push_back(outputPath);
@@ -53,58 +110,227 @@ uint32_t FfmpegProcess::run()
 {
   if (!startProcess())
   {
+    unique_lock<mutex> lock(processMutex);
+    processStartFailed = true;
+    processStartEvent.notify_all();
     return 0;
   }
   stdoutReader = shared_ptr<PipeReader>(new PipeReader("ffmpeg_stdout",
     processStdout));
-  stdoutReader->spawn();
+  if (reportsProgress)
+  {
+    stdoutReader->setLineListener([this](const string& line)
+    {
+      progress.parseLine(line);
+    });
+  }
   stderrReader = shared_ptr<PipeReader>(new PipeReader("ffmpeg_stderr",
     processStderr));
-  stderrReader->spawn();
+  auto notify = [this]()
+  {
+    unique_lock<mutex> lock(processMutex);
+    processEvent.notify_all();
+  };
+  stdoutReader->setCloseListener(notify);
+  stderrReader->setCloseListener(notify);
+
+  // Let the shared reactor read the pipes and tell us when the process exits. If it
+  // can't read the pipes then fall back to a thread per pipe
+  shared_ptr<Reactor> reactor = Reactor::shared();
+  bool pipesWatched = false;
+  if (reactor != nullptr)
+  {
+    pipesWatched = stdoutReader->watch(reactor) && stderrReader->watch(reactor);
+    if (pipesWatched)
+    {
+      processWatch = reactor->watchProcess(processPid, [this]()
+      {
+        unique_lock<mutex> lock(processMutex);
+        processExited = true;
+        processEvent.notify_all();
+      });
+    }
+    else
+    {
+      stdoutReader->unwatch();
+      stderrReader->unwatch();
+    }
+  }
+  if (!pipesWatched)
+  {
+    stdoutReader->spawn();
+    stderrReader->spawn();
+  }
   processMutex.lock();
   processStarted = true;
   processMutex.unlock();
-  processStartEvent.notify_one();
-  while (isProcessRunning())
+  processStartEvent.notify_all();
+
+  // Block until the process exits if the reactor isn't watching it, which is the case
+  // on Windows and on Linux kernels without pidfd support
+  if (processWatch == 0)
   {
-    if (!stdoutReader->isRunning() ||
-      !stderrReader->isRunning())
+    if (!platform::waitForProcess(processPid))
     {
-      printf("[FfmpegProcess] A process thread has exited unexpectedly\n");
-      break;
+      printf("[FfmpegProcess] Failed to wait for the process to exit\n");
     }
-    if (checkForExit())
+    unique_lock<mutex> lock(processMutex);
+    processExited = true;
+  }
+
+  // Sleep until the process has exited and the last of its output has been read
+  {
+    unique_lock<mutex> lock(processMutex);
+    processEvent.wait(lock, [this]()
     {
-      terminateProcess();
-      break;
-    }
-    platform::sleep(10);
+      return processExited && !stdoutReader->isOpen() && !stderrReader->isOpen();
+    });
+  }
+  if (pipesWatched)
+  {
+    stdoutReader->unwatch();
+    stderrReader->unwatch();
+  }
+  else
+  {
+    stdoutReader->terminate();
+    stderrReader->terminate();
   }
-  stdoutReader->terminate();
-  stderrReader->terminate();
 
-  // TODO: Iteratively print the output in the loop above
-  printf("## Ffmpeg process has exited\n");
-  printf("## Stdout: '%s'\n", stdoutReader->getData().c_str());
-  printf("## Stderr: '%s'\n", stderrReader->getData().c_str());
+  // Reap the process now that nothing else can signal it
+  int32_t code = 0;
+  bool reaped = platform::reapProcess(processPid, code);
+  processMutex.lock();
+  exitCodeValid = reaped;
+  exitCode = code;
+  processMutex.unlock();
+
+  // Log the end of ffmpeg's error output if it failed, since that's where it says why
+  if (reaped && (code != 0))
+  {
+    printf("[FfmpegProcess] Process exited with code %d: %s\n", code,
+      stderrReader->getData().c_str());
+  }
   cleanUpProcess();
   return 0;
 }
 
-bool FfmpegProcess::startProcess()
+void FfmpegProcess::exitSignalled()
 {
-  return platform::spawnProcess(executable, arguments, processPid, processStdin,
-    processStdout, processStderr);
+  // Kill the process so run() stops waiting for it. The process isn't reaped until
+  // after it's seen to exit so its pid can't have been reused
+  unique_lock<mutex> lock(processMutex);
+  if ((processPid != 0) && !processExited)
+  {
+    terminateProcess();
+  }
 }
 
-bool FfmpegProcess::isProcessRunning()
+FfmpegProcess::FfmpegProcess(string exec, vector<string> args) :
+  Thread("ffmpeg"),
+  executable(exec),
+  arguments(args),
+  framesWritten(0)
 {
-  std::unique_lock<std::mutex> lock(processMutex);
-  if (processPid == 0)
+}
+
+string FfmpegProcess::start()
+{
+  // The process is started by the thread, which waits for it to exit. Wait until the
+  // process is running so frames can be written as soon as we return
+  string error = spawn();
+  if (!error.empty())
+  {
+    return error;
+  }
+  unique_lock<mutex> lock(processMutex);
+  processStartEvent.wait(lock, [this]()
+  {
+    return processStarted || processStartFailed;
+  });
+  if (processStartFailed)
+  {
+    return "Failed to start ffmpeg";
+  }
+  lock.unlock();
+
+  // Describe the stream before the first frame
+  if (timestamped)
+  {
+    string header = matroska::header(width, height, fps, convertToYuv);
+    if (!writeStdin((uint8_t*)header.data(), header.size()))
+    {
+      return "Failed to write to ffmpeg";
+    }
+  }
+  return "";
+}
+
+bool FfmpegProcess::writeFrame(uint8_t* data, uint32_t length, int64_t timestamp)
+{
+  if (timestamped)
+  {
+    string header = matroska::blockHeader(timestamp, length);
+    if (!writeStdin((uint8_t*)header.data(), header.size()))
+    {
+      return false;
+    }
+  }
+  if (!writeStdin(data, length))
   {
     return false;
   }
-  return platform::isProcessRunning(processPid);
+  framesWritten += 1;
+  return true;
+}
+
+void FfmpegProcess::finish()
+{
+  waitForExit();
+}
+
+bool FfmpegProcess::getProgress(EncoderProgress& ret)
+{
+  if (!reportsProgress)
+  {
+    return false;
+  }
+  ret = progress.getProgress();
+  uint64_t written = framesWritten;
+  ret.lagFrames = (written > ret.frame) ? (written - ret.frame) : 0;
+  return true;
+}
+
+bool FfmpegProcess::getExitCode(int32_t& ret)
+{
+  unique_lock<mutex> lock(processMutex);
+  if (!exitCodeValid)
+  {
+    return false;
+  }
+  ret = exitCode;
+  return true;
+}
+
+bool FfmpegProcess::startProcess()
+{
+  // The pid is set under the lock because exitSignalled() may be called at any time
+  uint64_t pid = 0;
+  if (!platform::spawnProcess(executable, arguments, pid, processStdin, processStdout,
+    processStderr))
+  {
+    return false;
+  }
+  unique_lock<mutex> lock(processMutex);
+  processPid = pid;
+  return true;
+}
+
+bool FfmpegProcess::isProcessRunning()
+{
+  // Only the thread reaps the process, so this reports what the thread has seen
+  unique_lock<mutex> lock(processMutex);
+  return (processPid != 0) && !processExited;
 }
 
 void FfmpegProcess::waitForExit()
@@ -114,10 +340,7 @@ void FfmpegProcess::waitForExit()
     platform::close(processStdin);
     processStdin = 0;
   }
-  while (isRunning())
-  {
-    platform::sleep(10);
-  }
+  waitForCompletion();
 }
 
 bool FfmpegProcess::writeStdin(uint8_t* data, uint32_t length)
@@ -1,19 +1,32 @@
 #pragma once
 
+#include <atomic>
 #include <condition_variable>
 #include <memory>
 #include <mutex>
 #include <vector>
+#include "FfmpegProgress.h"
 #include "PipeReader.h"
+#include "Reactor.h"
 #include "Thread.h"
+#include "VideoEncoder.h"
+#include "VideoOptions.h"
 
-class FfmpegProcess : public Thread
+class FfmpegProcess : public Thread, public VideoEncoder
 {
 public:
   FfmpegProcess(std::string executable, uint32_t width, uint32_t height, uint32_t fps,
-    std::string encoder, std::string outputPath);
+    std::string encoder, std::string outputPath, VideoOptions options);
+  FfmpegProcess(std::string executable, std::vector<std::string> arguments);
   virtual ~FfmpegProcess() {};
 
+public:
+  std::string start();
+  bool writeFrame(uint8_t* data, uint32_t length, int64_t timestamp);
+  void finish();
+  bool getProgress(EncoderProgress& progress);
+  bool getExitCode(int32_t& exitCode);
+
 public:
   bool isProcessRunning();
   void waitForExit();
@@ -27,15 +40,32 @@ private:
   void terminateProcess();
   void cleanUpProcess();
 
+protected:
+  void exitSignalled();
+
 public:
   uint32_t run();
 
 private:
   std::string executable;
   std::vector<std::string> arguments;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t fps = 0;
+  bool convertToYuv = false;
+  bool timestamped = false;
+  bool reportsProgress = false;
+  FfmpegProgress progress;
+  std::atomic<uint64_t> framesWritten;
   bool processStarted = false;
+  bool processStartFailed = false;
   std::mutex processMutex;
   std::condition_variable processStartEvent;
+  std::condition_variable processEvent;
+  bool processExited = false;
+  bool exitCodeValid = false;
+  int32_t exitCode = 0;
+  uint64_t processWatch = 0;
   uint64_t processPid = 0;
   uint64_t processStdin = 0;
   uint64_t processStdout = 0;
@@ -0,0 +1,59 @@
+#include "FfmpegProgress.h"
+#include <stdlib.h>
+
+using namespace std;
+
+void FfmpegProgress::parseLine(const string& line)
+{
+  size_t equals = line.find('=');
+  if (equals == string::npos)
+  {
+    return;
+  }
+  string key = line.substr(0, equals);
+  string value = line.substr(equals + 1);
+
+  // Values that ffmpeg doesn't know yet are reported as "N/A", which parse as zero.
+  // Older versions of ffmpeg report out_time_ms in microseconds despite the name
+  if (key == "frame")
+  {
+    pending.frame = strtoull(value.c_str(), nullptr, 10);
+  }
+  else if (key == "fps")
+  {
+    pending.fps = strtod(value.c_str(), nullptr);
+  }
+  else if (key == "speed")
+  {
+    pending.speed = strtod(value.c_str(), nullptr);
+  }
+  else if ((key == "out_time_us") || (key == "out_time_ms"))
+  {
+    pending.outTime = strtoll(value.c_str(), nullptr, 10);
+  }
+  else if (key == "dup_frames")
+  {
+    pending.dupFrames = strtoull(value.c_str(), nullptr, 10);
+  }
+  else if (key == "drop_frames")
+  {
+    pending.dropFrames = strtoull(value.c_str(), nullptr, 10);
+  }
+  else if (key == "total_size")
+  {
+    pending.totalSize = strtoull(value.c_str(), nullptr, 10);
+  }
+  else if (key == "progress")
+  {
+    pending.valid = true;
+    pending.ended = (value == "end");
+    unique_lock<mutex> lock(progressMutex);
+    latest = pending;
+  }
+}
+
+EncoderProgress FfmpegProgress::getProgress()
+{
+  unique_lock<mutex> lock(progressMutex);
+  return latest;
+}
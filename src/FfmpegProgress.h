@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+typedef struct
+{
+  // True once ffmpeg has reported progress at least once
+  bool valid = false;
+
+  // True once ffmpeg has reported that encoding has ended
+  bool ended = false;
+
+  // The number of frames encoded and the rate they're being encoded at
+  uint64_t frame = 0;
+  double fps = 0;
+
+  // How fast encoding is running relative to real time. Below one the encoder is
+  // falling behind
+  double speed = 0;
+
+  // The timestamp of the latest output in microseconds
+  int64_t outTime = 0;
+
+  // The frames ffmpeg duplicated or dropped to keep a constant frame rate
+  uint64_t dupFrames = 0;
+  uint64_t dropFrames = 0;
+
+  // The size of the output so far in bytes
+  uint64_t totalSize = 0;
+
+  // The number of frames written to ffmpeg that it hasn't encoded yet
+  uint64_t lagFrames = 0;
+} EncoderProgress;
+
+// This class parses the key=value lines that ffmpeg writes when it's run with
+// "-progress". ffmpeg reports a block of keys several times a second, each ending with
+// a "progress" key, so the values are collected as lines arrive and published together
+// when the block is complete.
+class FfmpegProgress
+{
+public:
+  FfmpegProgress() {};
+  virtual ~FfmpegProgress() {};
+
+  void parseLine(const std::string& line);
+  EncoderProgress getProgress();
+
+private:
+  EncoderProgress pending;
+  EncoderProgress latest;
+  std::mutex progressMutex;
+};
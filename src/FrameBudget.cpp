@@ -0,0 +1,42 @@
+#include "FrameBudget.h"
+
+using namespace std;
+
+FrameBudget::FrameBudget(uint64_t max) :
+  maxBytes(max)
+{
+}
+
+bool FrameBudget::reserve(uint64_t bytes, int timeout)
+{
+  unique_lock<mutex> lock(budgetMutex);
+  auto fits = [this, bytes]()
+  {
+    return (maxBytes == 0) || (queuedBytes == 0) || (queuedBytes + bytes <= maxBytes);
+  };
+  if (!fits())
+  {
+    if ((timeout <= 0) ||
+      !budgetEvent.wait_for(lock, chrono::milliseconds(timeout), fits))
+    {
+      return false;
+    }
+  }
+  queuedBytes += bytes;
+  return true;
+}
+
+void FrameBudget::release(uint64_t bytes)
+{
+  {
+    unique_lock<mutex> lock(budgetMutex);
+    queuedBytes = (bytes < queuedBytes) ? (queuedBytes - bytes) : 0;
+  }
+  budgetEvent.notify_all();
+}
+
+uint64_t FrameBudget::getQueuedBytes()
+{
+  unique_lock<mutex> lock(budgetMutex);
+  return queuedBytes;
+}
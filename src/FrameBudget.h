@@ -0,0 +1,29 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+// This class limits the number of bytes of frame data that are waiting for the frame
+// thread. Space is reserved when JavaScript queues a frame and released once the frame
+// thread has taken it off the queue. A frame is always accepted when nothing else is
+// waiting so that a frame larger than the budget can't stall the pipeline.
+class FrameBudget
+{
+public:
+  FrameBudget(uint64_t maxBytes);
+  virtual ~FrameBudget() {};
+
+  // Reserves space for a frame, waiting up to the timeout for it to become available.
+  // A budget of zero accepts everything
+  bool reserve(uint64_t bytes, int timeout);
+  void release(uint64_t bytes);
+
+  uint64_t getQueuedBytes();
+
+private:
+  uint64_t maxBytes;
+  uint64_t queuedBytes = 0;
+  std::mutex budgetMutex;
+  std::condition_variable budgetEvent;
+};
@@ -1,4 +1,5 @@
 #include "FrameHeader.h"
+#include <cstring>
 #include <sstream>
 
 using namespace std;
@@ -0,0 +1,124 @@
+#include "FramePool.h"
+#include "Platform.h"
+
+using namespace std;
+
+// Define constants to keep track of the three states that a buffer can be in
+#define BUFFER_FREE 0
+#define BUFFER_ACQUIRED 1
+#define BUFFER_SUBMITTED 2
+
+FrameMemory::FrameMemory(size_t len)
+{
+  data = platform::allocatePages(len);
+  if (data != nullptr)
+  {
+    length = len;
+  }
+}
+
+FrameMemory::~FrameMemory()
+{
+  if (data != nullptr)
+  {
+    platform::freePages(data, length);
+  }
+}
+
+FramePool::FramePool(uint32_t max) :
+  maxBuffers(max)
+{
+}
+
+bool FramePool::acquire(uint32_t width, uint32_t height, uint32_t& handle,
+  shared_ptr<FrameMemory>& memory)
+{
+  unique_lock<mutex> lock(poolMutex);
+  size_t length = (size_t)width * (size_t)height * 4;
+
+  // Prefer a free buffer that already has the right size, then a new buffer if we
+  // haven't reached the limit, and finally a free buffer of the wrong size which
+  // we'll reallocate
+  int32_t index = -1;
+  for (uint32_t i = 0; i < slots.size(); ++i)
+  {
+    if ((slots[i].state == BUFFER_FREE) && (slots[i].memory != nullptr) &&
+      (slots[i].memory->length == length))
+    {
+      index = i;
+      break;
+    }
+  }
+  if ((index == -1) && (slots.size() < maxBuffers))
+  {
+    Slot slot;
+    slot.state = BUFFER_FREE;
+    slots.push_back(slot);
+    index = slots.size() - 1;
+  }
+  if (index == -1)
+  {
+    for (uint32_t i = 0; i < slots.size(); ++i)
+    {
+      if (slots[i].state == BUFFER_FREE)
+      {
+        index = i;
+        break;
+      }
+    }
+  }
+  if (index == -1)
+  {
+    return false;
+  }
+
+  // Allocate memory for the buffer if needed. Any previous memory will be released
+  // once JavaScript lets go of it
+  Slot& slot = slots[index];
+  if ((slot.memory == nullptr) || (slot.memory->length != length))
+  {
+    slot.memory = shared_ptr<FrameMemory>(new FrameMemory(length));
+    if (slot.memory->data == nullptr)
+    {
+      slot.memory = nullptr;
+      return false;
+    }
+  }
+  slot.width = width;
+  slot.height = height;
+  slot.state = BUFFER_ACQUIRED;
+  handle = index + 1;
+  memory = slot.memory;
+  return true;
+}
+
+bool FramePool::submit(uint32_t handle, uint8_t*& data, size_t& length,
+  uint32_t& width, uint32_t& height)
+{
+  unique_lock<mutex> lock(poolMutex);
+  if ((handle == 0) || (handle > slots.size()))
+  {
+    return false;
+  }
+  Slot& slot = slots[handle - 1];
+  if (slot.state != BUFFER_ACQUIRED)
+  {
+    return false;
+  }
+  slot.state = BUFFER_SUBMITTED;
+  data = slot.memory->data;
+  length = slot.memory->length;
+  width = slot.width;
+  height = slot.height;
+  return true;
+}
+
+void FramePool::release(uint32_t handle)
+{
+  unique_lock<mutex> lock(poolMutex);
+  if ((handle == 0) || (handle > slots.size()))
+  {
+    return;
+  }
+  slots[handle - 1].state = BUFFER_FREE;
+}
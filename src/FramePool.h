@@ -0,0 +1,53 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// A block of page-aligned memory that holds a single frame. The memory is released
+// when the last reference to it goes away, which may be after the pool that created
+// it has been destroyed if JavaScript is still holding on to a view of it.
+class FrameMemory
+{
+public:
+  FrameMemory(size_t length);
+  virtual ~FrameMemory();
+
+  uint8_t* data = nullptr;
+  size_t length = 0;
+};
+
+// This class manages a fixed number of frame buffers that are handed to JavaScript,
+// filled with captured frames, and submitted back to the recording pipeline without
+// being copied. Each buffer moves through the following states:
+//
+// - Free: Available to be acquired
+// - Acquired: Owned by JavaScript, which is filling it with a frame
+// - Submitted: Owned by the frame thread until the frame has been written
+//
+// Buffers are identified by a handle that is never zero.
+class FramePool
+{
+public:
+  FramePool(uint32_t maxBuffers);
+  virtual ~FramePool() {};
+
+  bool acquire(uint32_t width, uint32_t height, uint32_t& handle,
+    std::shared_ptr<FrameMemory>& memory);
+  bool submit(uint32_t handle, uint8_t*& data, size_t& length, uint32_t& width,
+    uint32_t& height);
+  void release(uint32_t handle);
+
+private:
+  typedef struct
+  {
+    std::shared_ptr<FrameMemory> memory;
+    uint32_t width;
+    uint32_t height;
+    uint32_t state;
+  } Slot;
+
+  uint32_t maxBuffers;
+  std::vector<Slot> slots;
+  std::mutex poolMutex;
+};
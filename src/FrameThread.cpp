@@ -1,6 +1,9 @@
 #include "FrameThread.h"
+#include "ColorConvert.h"
+#include "Downscale.h"
 #include "FrameHeader.h"
 #include "Platform.h"
+#include <cstring>
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
@@ -14,16 +17,27 @@ using namespace cv;
 #define CHANNEL_OPEN 2
 #define CHANNEL_ERROR 3
 
-FrameThread::FrameThread(shared_ptr<FfmpegProcess> process,
-    shared_ptr<Queue<FrameWrapper*>> pendingQueue,
-    shared_ptr<Queue<FrameWrapper*>> completedQueue, uint32_t wid, uint32_t hgt) :
+FrameThread::FrameThread(shared_ptr<VideoEncoder> encoder,
+    shared_ptr<RingQueue<FrameWrapper*>> pendingQueue,
+    shared_ptr<RingQueue<FrameWrapper*>> completedQueue, shared_ptr<FramePool> pool,
+    shared_ptr<FrameBudget> budget, shared_ptr<PipelineStats> st, uint32_t wid,
+    uint32_t hgt, uint32_t rate, VideoOptions opt) :
   Thread("frame"),
-  ffmpegProcess(process),
+  videoEncoder(encoder),
   pendingFrameQueue(pendingQueue),
   completedFrameQueue(completedQueue),
+  framePool(pool),
+  frameBudget(budget),
+  stats(st),
   width(wid),
-  height(hgt)
+  height(hgt),
+  fps(rate),
+  options(opt)
 {
+  if (options.convertToYuv)
+  {
+    yuvFrame.resize(colorconvert::yuv420Length(width, height));
+  }
 }
 
 uint32_t FrameThread::run()
@@ -31,6 +45,8 @@ uint32_t FrameThread::run()
   printf("[FrameThread] ## Thread starting\n");
   
   uint32_t frameNumber = 0;
+  bool holdingFrame = false;
+  int64_t heldTimestamp = 0;
   uint32_t channelState = CHANNEL_CLOSED;
   uint64_t namedPipeId = 0;
   while (!checkForExit())
@@ -38,30 +54,139 @@ uint32_t FrameThread::run()
     FrameWrapper* wrapper = 0;
     if (!pendingFrameQueue->waitItem(&wrapper, 50))
     {
+      passOverflowFrames();
       continue;
     }
 
-    printf("[FrameThread] ## Got frame\n");
+    // An empty item means no more frames are coming. Everything queued ahead of it
+    // has been written, so leave the loop and flush the held frame below
+    if (wrapper == nullptr)
+    {
+      break;
+    }
+
+    // Pass frames that JavaScript dropped after queueing them straight back.
+    // Otherwise release the frame's share of the budget now that it's off the queue
+    uint32_t queued = FRAME_QUEUED;
+    if (!wrapper->state.compare_exchange_strong(queued, FRAME_TAKEN))
+    {
+      completeFrame(wrapper);
+      continue;
+    }
+    if ((wrapper->handle == 0) && !wrapper->duplicate)
+    {
+      frameBudget->release(wrapper->length);
+    }
+    int64_t stageStart = stats->recordStage(STAGE_QUEUE_WAIT, wrapper->queuedTime);
+
+    // Duplicates write the last frame to the encoder again, or simply extend the held
+    // frame when repeated frames are being elided
+    if (wrapper->duplicate)
+    {
+      if (options.elideDuplicates)
+      {
+        holdingFrame = !previousFrame.empty();
+        heldTimestamp = wrapper->timestamp;
+      }
+      else if ((lastEncoderData != nullptr) &&
+        !writeEncoderFrame(lastEncoderData, lastEncoderLength,
+        frameTimestamp(frameNumber, wrapper->timestamp)))
+      {
+        printf("[FrameThread] Failed to write to encoder\n");
+        break;
+      }
+      completeFrame(wrapper);
+      frameNumber += 1;
+      continue;
+    }
 
     // Frames captured by the Electron framework are encoded in the BGRA colorspace and
-    // may be larger than size of the stimulus window.
+    // may be larger than size of the stimulus window. Use the fast box filter when the
+    // capture is an exact multiple of the stimulus size, as it is on HiDPI displays.
     Mat frame(wrapper->height, wrapper->width, CV_8UC4, wrapper->frame);
     if ((wrapper->width != width) || (wrapper->height != height))
     {
-      Mat resizedFrame;
-      resize(frame, resizedFrame, Size2i(width, height), 0, 0, INTER_AREA);
+      uint32_t factor = downscale::integerFactor(wrapper->width, wrapper->height, width,
+        height);
+      if (factor != 0)
+      {
+        resizedFrame.create(height, width, CV_8UC4);
+        downscale::bgra(frame.data, frame.step, resizedFrame.data, resizedFrame.step,
+          width, height, factor);
+      }
+      else
+      {
+        resize(frame, resizedFrame, Size2i(width, height), 0, 0, INTER_AREA);
+      }
       frame = resizedFrame;
     }
 
-    // Write the raw frame to the ffmpeg process
+    // Convert the frame to YUV if requested and write it to the encoder
     uint32_t frameLength = frame.total() * frame.elemSize();
-    if (!ffmpegProcess->writeStdin(frame.data, frameLength))
+    uint8_t* encoderData = frame.data;
+    uint32_t encoderLength = frameLength;
+    if (options.convertToYuv)
     {
-      printf("[FrameThread] Failed to write to FFmpeg process\n");
+      colorconvert::bgraToYuv420(frame.data, frame.step, width, height, yuvFrame.data(),
+        options.colorMatrix, options.fullRange);
+      encoderData = yuvFrame.data();
+      encoderLength = yuvFrame.size();
+    }
+    stats->recordStage(STAGE_RESIZE, stageStart);
+
+    // Hold frames that are identical to the previous one rather than writing them.
+    // The next frame that is written carries its own timestamp so the timing is kept
+    holdingFrame = options.elideDuplicates &&
+      isRepeatedFrame(encoderData, encoderLength);
+    if (holdingFrame)
+    {
+      heldTimestamp = wrapper->timestamp;
+    }
+    else if (!writeEncoderFrame(encoderData, encoderLength,
+      frameTimestamp(frameNumber, wrapper->timestamp)))
+    {
+      printf("[FrameThread] Failed to write to encoder\n");
 	  break;
     }
 
-    // Create the preview channel
+    // Remember the frame in case it needs to be duplicated. JavaScript only queues a
+    // duplicate behind a frame the thread hasn't taken yet, so a frame that still
+    // points at memory that's about to be given back is only copied if more frames
+    // are waiting
+    if ((options.overloadPolicy == OVERLOAD_POLICY_DUPLICATE_LAST) &&
+      !options.elideDuplicates)
+    {
+      if (encoderData == wrapper->frame)
+      {
+        if (pendingFrameQueue->empty())
+        {
+          encoderData = nullptr;
+        }
+        else
+        {
+          lastFrame.assign(encoderData, encoderData + encoderLength);
+          encoderData = lastFrame.data();
+        }
+      }
+      lastEncoderData = encoderData;
+      lastEncoderLength = encoderLength;
+    }
+
+    // Publish the frame to the shared memory ring if the preview channel uses one
+    stageStart = PipelineStats::now();
+    shared_ptr<SharedFrameRing> ring;
+    {
+      unique_lock<mutex> lock(previewChannelMutex);
+      ring = previewRing;
+    }
+    bool previewWritten = false;
+    if (ring != nullptr)
+    {
+      writePreviewFrame(ring.get(), frame, frameNumber);
+      previewWritten = true;
+    }
+
+    // Otherwise create the named pipe preview channel
     if (channelState == CHANNEL_CLOSED)
     {
       unique_lock<mutex> lock(previewChannelMutex);
@@ -73,9 +198,8 @@ uint32_t FrameThread::run()
         {
           printf("[FrameThread] Failed to create named pipe\n");
           channelState = CHANNEL_ERROR;
-          continue;
         }
-        if (namedPipeId != 0)
+        else if (namedPipeId != 0)
         {
           channelState = opening ? CHANNEL_OPENING : CHANNEL_OPEN;
         }
@@ -90,58 +214,247 @@ uint32_t FrameThread::run()
       {
         printf("[FrameThread] Named pipe connetion failed\n");
         channelState = CHANNEL_ERROR;
-        continue;
       }
-      if (opened)
+      else if (opened)
       {
         printf("## [FrameThread] Renderer process has connected\n");
         channelState = CHANNEL_OPEN;
       }
     }
     
-    // Write the frame to the named pipe once the connection is established
+    // Write the frame to the named pipe once the connection is established. The
+    // writer skips the frame if the renderer hasn't read the previous one yet
     if (channelState == CHANNEL_OPEN)
     {
+      if (previewWriter == nullptr)
+      {
+        previewWriter = shared_ptr<PipeWriter>(new PipeWriter(namedPipeId));
+      }
       string header = frameheader::format(frameNumber, width, height, frameLength);
-      if (!writeAll(namedPipeId, (const uint8_t*)header.data(), header.size()) ||
-        !writeAll(namedPipeId, (const uint8_t*)frame.data, frameLength))
+      bool skipped = false;
+      if (!previewWriter->writeFrame(header, frame.data, frameLength, skipped))
       {
         printf("[FrameThread] Failed to write frame to pipe\n");
         channelState = CHANNEL_ERROR;
-        continue;
       }
+      previewWritten = true;
     }
-    
-    // Add the frame to the completed queue
-    completedFrameQueue->addItem(wrapper);
+    if (previewWritten)
+    {
+      stats->recordStage(STAGE_PREVIEW_WRITE, stageStart);
+    }
+
+    completeFrame(wrapper);
     frameNumber += 1;
   }
 
+  // Write the held frame again so the video lasts until the final frame. This only
+  // happens when the thread leaves the loop itself, which is why the video output is
+  // closed by queueing an empty item rather than cancelling the thread
+  if (holdingFrame && (frameNumber > 0))
+  {
+    writeEncoderFrame(previousFrame.data(), previousFrame.size(),
+      frameTimestamp(frameNumber - 1, heldTimestamp));
+  }
+
   // Close the preview channel
+  previewWriter = nullptr;
   if (channelState != CHANNEL_CLOSED)
   {
     platform::closeNamedPipeForWriting(previewChannelName, namedPipeId);
   }
+  {
+    unique_lock<mutex> lock(previewChannelMutex);
+    if (previewRing != nullptr)
+    {
+      previewRing->markClosed();
+    }
+  }
+
+  // Hand over whatever completed frames still fit. The output is being closed so
+  // nothing will make room for the rest
+  passOverflowFrames();
+  for (FrameWrapper* wrapper : overflowFrames)
+  {
+    delete wrapper;
+  }
+  overflowFrames.clear();
   return 0;
 }
 
+void FrameThread::finish()
+{
+  // The thread owns the encoder's state while it's writing a frame, which can take far
+  // longer than terminate() waits at high resolutions, so it's never cancelled. Queue
+  // an empty item after the last frame and wait for the thread to reach it
+  while (isRunning() && !pendingFrameQueue->addItem(nullptr, 50))
+  {
+  }
+  waitForCompletion();
+}
+
 void FrameThread::setPreviewChannel(string channelName)
 {
   unique_lock<mutex> lock(previewChannelMutex);
   previewChannelName = channelName;
 }
 
-bool FrameThread::writeAll(uint64_t file, const uint8_t* buffer, uint32_t length)
+void FrameThread::writePreviewFrame(SharedFrameRing* ring, Mat& frame,
+  uint32_t frameNumber)
 {
-  uint32_t bytesWritten = 0;
-  while (bytesWritten < length)
+  // Skip the frame if the renderer has asked for a lower frame rate and it isn't
+  // time for the next one yet
+  uint32_t maxWidth, maxHeight, maxFps;
+  ring->getRequest(maxWidth, maxHeight, maxFps);
+  chrono::steady_clock::time_point now = chrono::steady_clock::now();
+  if (maxFps != 0)
+  {
+    if (now < nextPreviewTime)
+    {
+      return;
+    }
+    nextPreviewTime = max(nextPreviewTime + chrono::microseconds(1000000 / maxFps), now);
+  }
+
+  // Scale the frame down to the size of the preview. The frame is never enlarged
+  Mat* preview = &frame;
+  if ((maxWidth != 0) && (maxHeight != 0) &&
+    ((maxWidth < (uint32_t)frame.cols) || (maxHeight < (uint32_t)frame.rows)))
   {
-    int32_t ret = platform::write(file, buffer + bytesWritten, length - bytesWritten);
-    if (ret == -1)
+    uint32_t previewWidth, previewHeight;
+    downscale::fitWithin(frame.cols, frame.rows, maxWidth, maxHeight, previewWidth,
+      previewHeight);
+    if ((previewWidth != 0) && (previewHeight != 0))
     {
-      return false;
+      uint32_t factor = downscale::integerFactor(frame.cols, frame.rows, previewWidth,
+        previewHeight);
+      if (factor != 0)
+      {
+        previewFrame.create(previewHeight, previewWidth, CV_8UC4);
+        downscale::bgra(frame.data, frame.step, previewFrame.data, previewFrame.step,
+          previewWidth, previewHeight, factor);
+      }
+      else
+      {
+        resize(frame, previewFrame, Size2i(previewWidth, previewHeight), 0, 0,
+          INTER_AREA);
+      }
+      preview = &previewFrame;
     }
-    bytesWritten += ret;
   }
+  ring->writeFrame(frameNumber, preview->cols, preview->rows, preview->data,
+    preview->total() * preview->elemSize());
+}
+
+void FrameThread::setPreviewRing(shared_ptr<SharedFrameRing> ring)
+{
+  unique_lock<mutex> lock(previewChannelMutex);
+  previewRing = ring;
+}
+
+void FrameThread::setCompletionListener(function<void()> listener)
+{
+  unique_lock<mutex> lock(completionListenerMutex);
+  completionListener = listener;
+}
+
+bool FrameThread::isRepeatedFrame(uint8_t* data, uint32_t length)
+{
+  // Compare the frame with the previous one. memcmp is vectorized by the C library and
+  // stops at the first difference, so frames that changed are usually rejected early
+  if ((previousFrame.size() == length) &&
+    (memcmp(previousFrame.data(), data, length) == 0))
+  {
+    return true;
+  }
+
+  // Keep the frame for the next comparison. The YUV buffer is swapped rather than
+  // copied since it's refilled for every frame anyway
+  if ((data == yuvFrame.data()) && (previousFrame.size() == length))
+  {
+    previousFrame.swap(yuvFrame);
+  }
+  else
+  {
+    previousFrame.assign(data, data + length);
+  }
+  return false;
+}
+
+bool FrameThread::writeEncoderFrame(uint8_t* data, uint32_t length, int64_t timestamp)
+{
+  int64_t start = PipelineStats::now();
+  if (!videoEncoder->writeFrame(data, length, timestamp))
+  {
+    return false;
+  }
+  stats->recordStage(STAGE_ENCODER_WRITE, start);
+  stats->addWrittenFrame(length);
   return true;
 }
+
+int64_t FrameThread::frameTimestamp(uint32_t frameNumber, int64_t captureTimestamp)
+{
+  // Count frames at the nominal frame rate, or measure from the first frame's capture
+  // time. Timestamps must always increase so frames captured too close together are
+  // nudged forward
+  int64_t timestamp = (int64_t)frameNumber * 1000000 / fps;
+  if (options.timestamps == TIMESTAMPS_CAPTURE)
+  {
+    if (firstCaptureTimestamp < 0)
+    {
+      firstCaptureTimestamp = captureTimestamp;
+    }
+    timestamp = max(captureTimestamp - firstCaptureTimestamp, lastTimestamp + 1);
+  }
+  lastTimestamp = timestamp;
+  return timestamp;
+}
+
+void FrameThread::completeFrame(FrameWrapper* wrapper)
+{
+  // Return pooled buffers as soon as we're done with them and add the frame to the
+  // completed queue. If JavaScript has fallen so far behind that the queue is full,
+  // keep the frame aside rather than waiting. JavaScript may itself be waiting for
+  // this thread to take a frame, so blocking here could stall both threads for good
+  if (wrapper->handle != 0)
+  {
+    framePool->release(wrapper->handle);
+  }
+  wrapper->completedTime = PipelineStats::now();
+  passOverflowFrames();
+  if (!overflowFrames.empty() || !completedFrameQueue->addItem(wrapper))
+  {
+    overflowFrames.push_back(wrapper);
+  }
+  notifyCompletion();
+}
+
+void FrameThread::passOverflowFrames()
+{
+  // Move frames that didn't fit in the completed queue earlier across in order
+  if (overflowFrames.empty())
+  {
+    return;
+  }
+  uint32_t count = 0;
+  while ((count < overflowFrames.size()) &&
+    completedFrameQueue->addItem(overflowFrames[count]))
+  {
+    count += 1;
+  }
+  if (count > 0)
+  {
+    overflowFrames.erase(overflowFrames.begin(), overflowFrames.begin() + count);
+    notifyCompletion();
+  }
+}
+
+void FrameThread::notifyCompletion()
+{
+  unique_lock<mutex> lock(completionListenerMutex);
+  if (completionListener)
+  {
+    completionListener();
+  }
+}
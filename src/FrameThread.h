@@ -1,9 +1,26 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
 #include <mutex>
-#include "FfmpegProcess.h"
+#include <opencv2/core/core.hpp>
+#include "FrameBudget.h"
+#include "FramePool.h"
+#include "PipelineStats.h"
+#include "PipeWriter.h"
 #include "Thread.h"
-#include "Queue.hpp"
+#include "RingQueue.hpp"
+#include "SharedFrameRing.h"
+#include "VideoEncoder.h"
+#include "VideoOptions.h"
+
+// Define constants for the states of a queued frame. JavaScript can drop a frame that
+// the frame thread hasn't taken yet, and whichever side changes the state first wins
+#define FRAME_QUEUED 0
+#define FRAME_TAKEN 1
+#define FRAME_DROPPED 2
 
 typedef struct
 {
@@ -12,29 +29,81 @@ typedef struct
   uint32_t width;
   uint32_t height;
   uint32_t id;
+  uint32_t handle;
+
+  // The time the frame was captured in microseconds on a monotonic clock
+  int64_t timestamp;
+
+  // When the frame was placed in the pending queue and the completed queue, used to
+  // time how long frames wait on either side of the frame thread
+  int64_t queuedTime;
+  int64_t completedTime;
+
+  // Duplicates repeat the last frame that was written and have no frame of their own
+  bool duplicate;
+  std::atomic<uint32_t> state;
 } FrameWrapper;
 
 class FrameThread : public Thread
 {
 public:
-  FrameThread(std::shared_ptr<FfmpegProcess> ffmpegProcess,
-    std::shared_ptr<Queue<FrameWrapper*>> pendingFrameQueue,
-    std::shared_ptr<Queue<FrameWrapper*>> completedFrameQueue, uint32_t width, uint32_t height);
+  FrameThread(std::shared_ptr<VideoEncoder> videoEncoder,
+    std::shared_ptr<RingQueue<FrameWrapper*>> pendingFrameQueue,
+    std::shared_ptr<RingQueue<FrameWrapper*>> completedFrameQueue,
+    std::shared_ptr<FramePool> framePool, std::shared_ptr<FrameBudget> frameBudget,
+    std::shared_ptr<PipelineStats> stats, uint32_t width, uint32_t height,
+    uint32_t fps, VideoOptions options);
   virtual ~FrameThread() {};
 
   uint32_t run();
 
+  // Tells the thread that no more frames are coming and waits for it to write the
+  // frames already queued and exit. Must be called from the thread that queues frames
+  void finish();
+
+  uint32_t getWidth() { return width; }
+  uint32_t getHeight() { return height; }
   void setPreviewChannel(std::string channelName);
+  void setPreviewRing(std::shared_ptr<SharedFrameRing> ring);
+  void setCompletionListener(std::function<void()> listener);
 
 protected:
-  bool writeAll(uint64_t file, const uint8_t* buffer, uint32_t length);
+  void completeFrame(FrameWrapper* wrapper);
+  void passOverflowFrames();
+  void notifyCompletion();
+  bool isRepeatedFrame(uint8_t* data, uint32_t length);
+  bool writeEncoderFrame(uint8_t* data, uint32_t length, int64_t timestamp);
+  int64_t frameTimestamp(uint32_t frameNumber, int64_t captureTimestamp);
+  void writePreviewFrame(SharedFrameRing* ring, cv::Mat& frame, uint32_t frameNumber);
 
 private:
-  std::shared_ptr<FfmpegProcess> ffmpegProcess;
-  std::shared_ptr<Queue<FrameWrapper*>> pendingFrameQueue;
-  std::shared_ptr<Queue<FrameWrapper*>> completedFrameQueue;
+  std::shared_ptr<VideoEncoder> videoEncoder;
+  std::shared_ptr<RingQueue<FrameWrapper*>> pendingFrameQueue;
+  std::shared_ptr<RingQueue<FrameWrapper*>> completedFrameQueue;
+  std::shared_ptr<FramePool> framePool;
+  std::shared_ptr<FrameBudget> frameBudget;
+  std::shared_ptr<PipelineStats> stats;
   uint32_t width;
   uint32_t height;
+  uint32_t fps;
+  VideoOptions options;
+  cv::Mat resizedFrame;
+  std::vector<uint8_t> yuvFrame;
+  std::vector<uint8_t> lastFrame;
+  std::vector<uint8_t> previousFrame;
+  uint8_t* lastEncoderData = nullptr;
+  uint32_t lastEncoderLength = 0;
+  int64_t firstCaptureTimestamp = -1;
+  int64_t lastTimestamp = -1;
   std::string previewChannelName;
+  std::shared_ptr<PipeWriter> previewWriter;
+  std::shared_ptr<SharedFrameRing> previewRing;
+  cv::Mat previewFrame;
+  std::chrono::steady_clock::time_point nextPreviewTime;
   std::mutex previewChannelMutex;
+  std::function<void()> completionListener;
+  std::mutex completionListenerMutex;
+
+  // Completed frames that didn't fit in the completed queue, oldest first
+  std::deque<FrameWrapper*> overflowFrames;
 };
@@ -0,0 +1,18 @@
+// Kernels_avx2.cpp: This file compiles the image kernels a second time with AVX2
+// enabled. It's built as a separate library with its own compiler flags, so nothing
+// else should be added to it, and its functions must only be called after checking
+// that the CPU supports AVX2.
+
+#define CV_CPU_DISPATCH_MODE AVX2
+#include <immintrin.h>
+#define CV_AVX 1
+#define CV_AVX2 1
+#define CV_FMA3 1
+#define CV_SSE3 1
+#define CV_SSSE3 1
+#define CV_SSE4_1 1
+#define CV_SSE4_2 1
+
+#define KERNEL_NAMESPACE avx2
+#include "ColorConvert.simd.hpp"
+#include "Downscale.simd.hpp"
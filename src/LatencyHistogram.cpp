@@ -0,0 +1,104 @@
+#include "LatencyHistogram.h"
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+
+LatencyHistogram::LatencyHistogram()
+{
+  reset();
+}
+
+void LatencyHistogram::record(int64_t value)
+{
+  uint64_t clamped = (value < 0) ? 0 : min((uint64_t)value,
+    ((uint64_t)1 << HISTOGRAM_VALUE_BITS) - 1);
+  buckets[bucketIndex(clamped)].fetch_add(1, memory_order_relaxed);
+  count.fetch_add(1, memory_order_relaxed);
+  sum.fetch_add(clamped, memory_order_relaxed);
+
+  // Only the thread that moves the minimum or maximum has to retry
+  uint64_t current = minValue.load(memory_order_relaxed);
+  while ((clamped < current) &&
+    !minValue.compare_exchange_weak(current, clamped, memory_order_relaxed))
+  {
+  }
+  current = maxValue.load(memory_order_relaxed);
+  while ((clamped > current) &&
+    !maxValue.compare_exchange_weak(current, clamped, memory_order_relaxed))
+  {
+  }
+}
+
+void LatencyHistogram::reset()
+{
+  for (uint32_t i = 0; i < HISTOGRAM_BUCKETS; ++i)
+  {
+    buckets[i].store(0, memory_order_relaxed);
+  }
+  count.store(0, memory_order_relaxed);
+  sum.store(0, memory_order_relaxed);
+  minValue.store(UINT64_MAX, memory_order_relaxed);
+  maxValue.store(0, memory_order_relaxed);
+}
+
+HistogramSummary LatencyHistogram::summarize()
+{
+  // Copy the buckets first so the percentiles are consistent with each other even if
+  // values are recorded in the meantime
+  vector<uint64_t> counts(HISTOGRAM_BUCKETS);
+  uint64_t total = 0;
+  for (uint32_t i = 0; i < HISTOGRAM_BUCKETS; ++i)
+  {
+    counts[i] = buckets[i].load(memory_order_relaxed);
+    total += counts[i];
+  }
+
+  HistogramSummary summary = {};
+  summary.count = total;
+  if (total == 0)
+  {
+    return summary;
+  }
+  summary.min = minValue.load(memory_order_relaxed);
+  summary.max = maxValue.load(memory_order_relaxed);
+  summary.mean = (double)sum.load(memory_order_relaxed) /
+    max(count.load(memory_order_relaxed), (uint64_t)1);
+
+  // Report each percentile as the highest value in the bucket that contains it,
+  // capped at the largest value actually seen
+  uint64_t* percentiles[] = {&summary.p50, &summary.p90, &summary.p99, &summary.p999};
+  const double fractions[] = {0.5, 0.9, 0.99, 0.999};
+  uint64_t cumulative = 0;
+  uint32_t index = 0;
+  for (uint32_t p = 0; p < 4; ++p)
+  {
+    uint64_t target = max((uint64_t)(fractions[p] * total + 0.5), (uint64_t)1);
+    while ((cumulative + counts[index] < target) && (index < HISTOGRAM_BUCKETS - 1))
+    {
+      cumulative += counts[index];
+      index += 1;
+    }
+    *percentiles[p] = min(bucketHighestValue(index), summary.max);
+  }
+  return summary;
+}
+
+uint32_t LatencyHistogram::bucketIndex(uint64_t value)
+{
+  // Values below twice the number of sub-buckets are counted exactly. Above that each
+  // power of two is shifted down until it fits within the sub-buckets
+  uint32_t shift = 0;
+  while ((value >> shift) >= 2 * HISTOGRAM_SUB_BUCKETS)
+  {
+    shift += 1;
+  }
+  return shift * HISTOGRAM_SUB_BUCKETS + (uint32_t)(value >> shift);
+}
+
+uint64_t LatencyHistogram::bucketHighestValue(uint32_t index)
+{
+  uint32_t shift = max(index / HISTOGRAM_SUB_BUCKETS, (uint32_t)1) - 1;
+  uint64_t mantissa = index - shift * HISTOGRAM_SUB_BUCKETS;
+  return ((mantissa + 1) << shift) - 1;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Each power of two is split into this many linear sub-buckets, which keeps the error
+// of a recorded value within about 3%
+#define HISTOGRAM_SUB_BUCKET_BITS 5
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BUCKET_BITS)
+
+// Values are recorded up to 2^40 microseconds, which is nearly two weeks. Larger
+// values are counted in the last bucket
+#define HISTOGRAM_VALUE_BITS 40
+#define HISTOGRAM_BUCKETS \
+  ((HISTOGRAM_VALUE_BITS - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+typedef struct
+{
+  uint64_t count;
+  uint64_t min;
+  uint64_t max;
+  double mean;
+  uint64_t p50;
+  uint64_t p90;
+  uint64_t p99;
+  uint64_t p999;
+} HistogramSummary;
+
+// This class counts durations in log-linear buckets, in the style of HdrHistogram.
+// Recording a value is a handful of relaxed atomic operations so any thread can record
+// without locking, and the percentiles are worked out from the buckets when the
+// histogram is summarized. Values recorded while the histogram is being reset may be
+// lost.
+class LatencyHistogram
+{
+public:
+  LatencyHistogram();
+  virtual ~LatencyHistogram() {};
+
+  void record(int64_t value);
+  void reset();
+  HistogramSummary summarize();
+
+private:
+  static uint32_t bucketIndex(uint64_t value);
+  static uint64_t bucketHighestValue(uint32_t index);
+
+  std::atomic<uint64_t> buckets[HISTOGRAM_BUCKETS];
+  std::atomic<uint64_t> count;
+  std::atomic<uint64_t> sum;
+  std::atomic<uint64_t> minValue;
+  std::atomic<uint64_t> maxValue;
+};
@@ -0,0 +1,167 @@
+#include "Matroska.h"
+#include <algorithm>
+
+using namespace std;
+
+// Define the element IDs that we use from the specification
+#define EBML_HEADER 0x1A45DFA3
+#define EBML_VERSION 0x4286
+#define EBML_READ_VERSION 0x42F7
+#define EBML_MAX_ID_LENGTH 0x42F2
+#define EBML_MAX_SIZE_LENGTH 0x42F3
+#define EBML_DOC_TYPE 0x4282
+#define EBML_DOC_TYPE_VERSION 0x4287
+#define EBML_DOC_TYPE_READ_VERSION 0x4285
+#define MKV_SEGMENT 0x18538067
+#define MKV_INFO 0x1549A966
+#define MKV_TIMESTAMP_SCALE 0x2AD7B1
+#define MKV_MUXING_APP 0x4D80
+#define MKV_WRITING_APP 0x5741
+#define MKV_TRACKS 0x1654AE6B
+#define MKV_TRACK_ENTRY 0xAE
+#define MKV_TRACK_NUMBER 0xD7
+#define MKV_TRACK_UID 0x73C5
+#define MKV_TRACK_TYPE 0x83
+#define MKV_FLAG_LACING 0x9C
+#define MKV_DEFAULT_DURATION 0x23E383
+#define MKV_CODEC_ID 0x86
+#define MKV_VIDEO 0xE0
+#define MKV_PIXEL_WIDTH 0xB0
+#define MKV_PIXEL_HEIGHT 0xBA
+#define MKV_COLOUR_SPACE 0x2EB524
+#define MKV_CLUSTER 0x1F43B675
+#define MKV_CLUSTER_TIMESTAMP 0xE7
+#define MKV_SIMPLE_BLOCK 0xA3
+
+// Timestamps are counted in units of this many nanoseconds
+#define MKV_NANOSECONDS_PER_TICK 1000
+
+// An eight byte size with every value bit set means the size is unknown
+#define MKV_UNKNOWN_SIZE 0x01FFFFFFFFFFFFFFull
+
+// The number of bytes in the block header before the frame itself
+#define MKV_BLOCK_PREFIX_SIZE 4
+
+static void appendId(string& out, uint32_t id)
+{
+  // IDs are stored with their length marker so write them without leading zeros
+  bool started = false;
+  for (int shift = 24; shift >= 0; shift -= 8)
+  {
+    uint8_t byte = (uint8_t)(id >> shift);
+    if (started || (byte != 0))
+    {
+      out.push_back((char)byte);
+      started = true;
+    }
+  }
+}
+
+static void appendSize(string& out, uint64_t size)
+{
+  // Always use the eight byte form, which is marked by a leading 0x01
+  if (size != MKV_UNKNOWN_SIZE)
+  {
+    size |= (1ull << 56);
+  }
+  for (int shift = 56; shift >= 0; shift -= 8)
+  {
+    out.push_back((char)(uint8_t)(size >> shift));
+  }
+}
+
+static void appendUint(string& out, uint32_t id, uint64_t value)
+{
+  string bytes;
+  for (int shift = 56; shift >= 0; shift -= 8)
+  {
+    uint8_t byte = (uint8_t)(value >> shift);
+    if (!bytes.empty() || (byte != 0) || (shift == 0))
+    {
+      bytes.push_back((char)byte);
+    }
+  }
+  appendId(out, id);
+  appendSize(out, bytes.size());
+  out += bytes;
+}
+
+static void appendBinary(string& out, uint32_t id, const string& value)
+{
+  appendId(out, id);
+  appendSize(out, value.size());
+  out += value;
+}
+
+static void appendMaster(string& out, uint32_t id, const string& children)
+{
+  appendBinary(out, id, children);
+}
+
+string matroska::header(uint32_t width, uint32_t height, uint32_t fps, bool yuv420)
+{
+  string ebml;
+  appendUint(ebml, EBML_VERSION, 1);
+  appendUint(ebml, EBML_READ_VERSION, 1);
+  appendUint(ebml, EBML_MAX_ID_LENGTH, 4);
+  appendUint(ebml, EBML_MAX_SIZE_LENGTH, 8);
+  appendBinary(ebml, EBML_DOC_TYPE, "matroska");
+  appendUint(ebml, EBML_DOC_TYPE_VERSION, 4);
+  appendUint(ebml, EBML_DOC_TYPE_READ_VERSION, 2);
+
+  string info;
+  appendUint(info, MKV_TIMESTAMP_SCALE, MKV_NANOSECONDS_PER_TICK);
+  appendBinary(info, MKV_MUXING_APP, "eye-native");
+  appendBinary(info, MKV_WRITING_APP, "eye-native");
+
+  // The colour space is the FourCC of the raw pixel format
+  string video;
+  appendUint(video, MKV_PIXEL_WIDTH, width);
+  appendUint(video, MKV_PIXEL_HEIGHT, height);
+  appendBinary(video, MKV_COLOUR_SPACE, yuv420 ? "I420" : "BGRA");
+
+  string track;
+  appendUint(track, MKV_TRACK_NUMBER, 1);
+  appendUint(track, MKV_TRACK_UID, 1);
+  appendUint(track, MKV_TRACK_TYPE, 1);
+  appendUint(track, MKV_FLAG_LACING, 0);
+  if (fps != 0)
+  {
+    appendUint(track, MKV_DEFAULT_DURATION, 1000000000ull / fps);
+  }
+  appendBinary(track, MKV_CODEC_ID, "V_UNCOMPRESSED");
+  appendMaster(track, MKV_VIDEO, video);
+
+  string tracks;
+  appendMaster(tracks, MKV_TRACK_ENTRY, track);
+
+  string out;
+  appendMaster(out, EBML_HEADER, ebml);
+  appendId(out, MKV_SEGMENT);
+  appendSize(out, MKV_UNKNOWN_SIZE);
+  appendMaster(out, MKV_INFO, info);
+  appendMaster(out, MKV_TRACKS, tracks);
+  return out;
+}
+
+string matroska::blockHeader(int64_t timestamp, uint32_t length)
+{
+  // Each frame gets its own cluster so the block's timestamp, which is a 16-bit offset
+  // from the cluster's, is always zero
+  string cluster;
+  appendUint(cluster, MKV_CLUSTER_TIMESTAMP, (uint64_t)max(timestamp, (int64_t)0));
+  appendId(cluster, MKV_SIMPLE_BLOCK);
+  appendSize(cluster, MKV_BLOCK_PREFIX_SIZE + (uint64_t)length);
+
+  // Track number one, a zero offset, and the key frame flag
+  cluster.push_back((char)0x81);
+  cluster.push_back((char)0x00);
+  cluster.push_back((char)0x00);
+  cluster.push_back((char)0x80);
+
+  string out;
+  appendId(out, MKV_CLUSTER);
+  appendSize(out, cluster.size() + length);
+  out += cluster;
+  return out;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// These functions wrap raw frames in a minimal Matroska stream so they can be piped to
+// ffmpeg with a timestamp each. Unlike the rawvideo format, which assumes a constant
+// frame rate, this lets frames be skipped without changing the timing of the frames
+// that follow. The stream consists of:
+//
+// - A header describing a single uncompressed video track, with timestamps counted
+//   in microseconds
+// - A cluster for each frame, holding one block with the frame's timestamp
+//
+// The segment and its clusters are written with sizes that don't depend on the number
+// of frames so the stream can be written as it goes.
+
+namespace matroska
+{
+  std::string header(uint32_t width, uint32_t height, uint32_t fps, bool yuv420);
+  std::string blockHeader(int64_t timestamp, uint32_t length);
+}
@@ -1,26 +1,100 @@
 #include "Native.h"
+#include "Downscale.h"
+#include "EncoderOptions.h"
 #include "FfmpegProcess.h"
 #include "FrameThread.h"
 #include "Platform.h"
+#include "PipelineStats.h"
 #include "PreviewThread.h"
+#include "QoiEncoder.h"
+#include "SegmentedEncoder.h"
+#include "SharedFrameRing.h"
 #include "Wrapper.h"
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <map>
 #include <stdio.h>
+#ifdef EYE_NATIVE_LIBAV
+#include "AvcodecEncoder.h"
+#endif
 
 using namespace std;
 using namespace cv;
 
+// The maximum number of frame buffers that can be acquired by JavaScript or waiting
+// to be written at any one time
+#define FRAME_POOL_SIZE 8
+
+// The capacity of the queues that pass frames to and from the frame thread
+#define FRAME_QUEUE_CAPACITY 1024
+
+// Everything that belongs to a single video output. Each session has its own frame
+// thread and encoder so several outputs can be recorded at the same time
+typedef struct
+{
+  shared_ptr<RingQueue<FrameWrapper*>> pendingFrameQueue;
+  shared_ptr<RingQueue<FrameWrapper*>> completedFrameQueue;
+  shared_ptr<FramePool> framePool;
+  shared_ptr<FrameBudget> frameBudget;
+  shared_ptr<PipelineStats> stats;
+  shared_ptr<VideoEncoder> videoEncoder;
+  shared_ptr<FrameThread> frameThread;
+  uint32_t nextFrameId;
+
+  // Frames in the pending queue in the order they were queued, which is also the
+  // order they complete in. Only touched on the JavaScript thread
+  deque<FrameWrapper*> queuedFrames;
+  uint32_t overloadPolicy;
+  uint64_t droppedFrames;
+
+  Napi::ThreadSafeFunction completionCallback;
+  bool completionCallbackSet;
+  atomic<bool> completionCallPending;
+} VideoSession;
+
 // Global variables
 string gFfmpegPath;
-bool gInitialized = false, gRecording = false;
-uint32_t gNextFrameId = 0;
-shared_ptr<Queue<FrameWrapper*>> gPendingFrameQueue(new Queue<FrameWrapper*>());
-shared_ptr<Queue<FrameWrapper*>> gCompletedFrameQueue(new Queue<FrameWrapper*>());
-shared_ptr<FfmpegProcess> gFfmpegProcess(nullptr);
-shared_ptr<FrameThread> gFrameThread(nullptr);
-shared_ptr<Queue<Mat*>> gPreviewFrameQueue(new Queue<Mat*>());
+bool gInitialized = false;
+map<uint32_t, shared_ptr<VideoSession>> gSessions;
+uint32_t gNextSessionHandle = 1;
+shared_ptr<TripleBuffer<PreviewFrame*>> gPreviewFrameBuffer(
+  new TripleBuffer<PreviewFrame*>());
+shared_ptr<PreviewFramePool> gPreviewFramePool(new PreviewFramePool(
+  PREVIEW_FRAME_POOL_SIZE));
 shared_ptr<PreviewThread> gPreviewThread(nullptr);
+uint32_t gPreviewMaxFps = 0;
+
+// The most recent preview frame taken from the preview thread, and the result of the
+// last time a preview frame was scaled and encoded. The result is returned again when
+// the same frame is requested with the same size and options. Both are only touched on
+// the JavaScript thread
+shared_ptr<PreviewFrame> gLatestPreviewFrame(nullptr);
+typedef struct
+{
+  uint32_t number;
+  int maxWidth;
+  int maxHeight;
+  uint32_t format;
+  uint32_t quality;
+  uint32_t width;
+  uint32_t height;
+  shared_ptr<vector<uint8_t>> data;
+} PreviewCache;
+PreviewCache gPreviewCache;
+
+// Returns the session with the given handle or null if there isn't one
+static shared_ptr<VideoSession> findSession(uint32_t handle)
+{
+  auto it = gSessions.find(handle);
+  if (it == gSessions.end())
+  {
+    return nullptr;
+  }
+  return it->second;
+}
 
 void native::initializeFfmpeg(Napi::Env env, string ffmpegPath)
 {
@@ -30,45 +104,230 @@ void native::initializeFfmpeg(Napi::Env env, string ffmpegPath)
 }
 
 string native::createVideoOutput(Napi::Env env, int width, int height, int fps, string encoder,
-  string outputPath)
+  string outputPath, VideoOptions options, uint32_t& handle)
 {
-  // Make sure we've been initialized and aren't currently recording
-  if (!gInitialized)
+  // Make sure we've been initialized. Only the ffmpeg backend needs to know where
+  // ffmpeg is
+  if (!gInitialized && (options.backend == VIDEO_BACKEND_FFMPEG))
   {
     return "Library has not been initialized";
   }
-  if (gRecording)
+
+  // The chroma planes of YUV 4:2:0 frames are subsampled in both directions so fall
+  // back to sending BGRA frames if either dimension is odd
+  if ((width % 2 != 0) || (height % 2 != 0))
   {
-    return "Recording already in progress";
+    options.convertToYuv = false;
   }
 
-  // Spawn the ffmpeg process
-  gFfmpegProcess = shared_ptr<FfmpegProcess>(new FfmpegProcess(gFfmpegPath, width, height,
-    fps, encoder, outputPath));
-  gFfmpegProcess->spawn();
+  // Fill in the named encoder profile and make sure the encoder accepts the settings
+  string error = encoderoptions::resolve(encoder, options.encoderOptions);
+  if (!error.empty())
+  {
+    return error;
+  }
 
-  // Spawn the thread that will feed frames to the ffmpeg process
-  gFrameThread = shared_ptr<FrameThread>(new FrameThread(gFfmpegProcess, gPendingFrameQueue,
-    gCompletedFrameQueue, width, height));
-  gFrameThread->spawn();
+  // Segments must line up with key frames, so they default to the GOP length or two
+  // seconds of video
+  bool segmented = (options.segmentWorkers > 1);
+  if (segmented)
+  {
+    if (options.backend != VIDEO_BACKEND_FFMPEG)
+    {
+      return "Segmented encoding requires the ffmpeg backend";
+    }
+    if (options.elideDuplicates || (options.timestamps == TIMESTAMPS_CAPTURE))
+    {
+      return "Segmented encoding requires evenly spaced frames";
+    }
+    uint32_t gop = options.encoderOptions.gop;
+    if (options.segmentFrames == 0)
+    {
+      options.segmentFrames = (gop != 0) ? gop : max(fps, 1) * 2;
+    }
+    if ((gop != 0) && (options.segmentFrames % gop != 0))
+    {
+      return "Segment length must be a multiple of the GOP";
+    }
+  }
 
-  gRecording = true;
+  // Start the encoder, which is either an ffmpeg process, a pool of ffmpeg processes
+  // encoding segments, or libavcodec running in this process
+  shared_ptr<VideoSession> session(new VideoSession);
+  if (options.backend == VIDEO_BACKEND_LIBAV)
+  {
+#ifdef EYE_NATIVE_LIBAV
+    session->videoEncoder = shared_ptr<VideoEncoder>(new AvcodecEncoder(width, height,
+      fps, encoder, outputPath, options));
+#else
+    return "This build does not include the libav backend";
+#endif
+  }
+  else if (segmented)
+  {
+    session->videoEncoder = shared_ptr<VideoEncoder>(new SegmentedEncoder(gFfmpegPath,
+      width, height, fps, encoder, outputPath, options));
+  }
+  else
+  {
+    session->videoEncoder = shared_ptr<VideoEncoder>(new FfmpegProcess(gFfmpegPath,
+      width, height, fps, encoder, outputPath, options));
+  }
+  error = session->videoEncoder->start();
+  if (!error.empty())
+  {
+    return error;
+  }
+
+  // Spawn the thread that will feed frames to the encoder
+  session->pendingFrameQueue = shared_ptr<RingQueue<FrameWrapper*>>(
+    new RingQueue<FrameWrapper*>(FRAME_QUEUE_CAPACITY));
+  session->completedFrameQueue = shared_ptr<RingQueue<FrameWrapper*>>(
+    new RingQueue<FrameWrapper*>(FRAME_QUEUE_CAPACITY));
+  session->framePool = shared_ptr<FramePool>(new FramePool(FRAME_POOL_SIZE));
+  session->frameBudget = shared_ptr<FrameBudget>(new FrameBudget(options.maxQueuedBytes));
+  session->stats = shared_ptr<PipelineStats>(new PipelineStats());
+  session->frameThread = shared_ptr<FrameThread>(new FrameThread(session->videoEncoder,
+    session->pendingFrameQueue, session->completedFrameQueue, session->framePool,
+    session->frameBudget, session->stats, width, height, max(fps, 1), options));
+  session->frameThread->spawn();
+  session->nextFrameId = 0;
+  session->overloadPolicy = options.overloadPolicy;
+  session->droppedFrames = 0;
+  session->completionCallbackSet = false;
+  session->completionCallPending = false;
+
+  handle = gNextSessionHandle++;
+  gSessions[handle] = session;
   return "";
 }
 
-int32_t native::queueNextFrame(Napi::Env env, uint8_t* frame, size_t length, int width,
-  int height)
+// Places a frame in the pending queue, waiting for room if the policy is to block
+static bool addPendingFrame(shared_ptr<VideoSession> session, FrameWrapper* wrapper)
+{
+  wrapper->queuedTime = PipelineStats::now();
+  bool added = session->pendingFrameQueue->addItem(wrapper);
+  while (!added && (session->overloadPolicy == OVERLOAD_POLICY_BLOCK) &&
+    session->frameThread->isRunning())
+  {
+    added = session->pendingFrameQueue->addItem(wrapper, 50);
+  }
+  if (added)
+  {
+    session->queuedFrames.push_back(wrapper);
+    session->stats->addQueuedFrame(session->pendingFrameQueue->size());
+  }
+  return added;
+}
+
+// Drops the oldest frame that the frame thread hasn't taken yet. The frame is still
+// passed back as completed so JavaScript knows it can reuse the buffer
+static bool dropOldestFrame(shared_ptr<VideoSession> session)
 {
-  printf("## queueNextFrame()\n");
-  fflush(stdout);
+  for (FrameWrapper* wrapper : session->queuedFrames)
+  {
+    uint32_t queued = FRAME_QUEUED;
+    if ((wrapper->handle == 0) && !wrapper->duplicate &&
+      wrapper->state.compare_exchange_strong(queued, FRAME_DROPPED))
+    {
+      session->frameBudget->release(wrapper->length);
+      session->droppedFrames += 1;
+      session->stats->addDroppedFrame();
+      return true;
+    }
+  }
+  return false;
+}
 
-  // Make sure we've been initialized and are recording
-  if (!gInitialized)
+// Reserves room in the budget for a frame, applying the session's overload policy if
+// it doesn't fit
+static bool reserveFrame(shared_ptr<VideoSession> session, size_t length,
+  uint32_t& status)
+{
+  shared_ptr<FrameBudget> budget = session->frameBudget;
+  if (budget->reserve(length, 0))
+  {
+    return true;
+  }
+  switch (session->overloadPolicy)
+  {
+    case OVERLOAD_POLICY_BLOCK:
+      // Wait for the frame thread to make room, giving up if it stops
+      status = FRAME_STATUS_DELAYED;
+      while (session->frameThread->isRunning())
+      {
+        if (budget->reserve(length, 50))
+        {
+          return true;
+        }
+      }
+      return false;
+    case OVERLOAD_POLICY_DROP_OLDEST:
+      while (dropOldestFrame(session))
+      {
+        if (budget->reserve(length, 0))
+        {
+          return true;
+        }
+      }
+      return false;
+    default:
+      return false;
+  }
+}
+
+// Queues a request for the frame thread to write the last frame again in place of a
+// frame captured at the given time
+static bool queueDuplicateFrame(shared_ptr<VideoSession> session, int64_t timestamp)
+{
+  FrameWrapper* wrapper = new FrameWrapper;
+  wrapper->frame = nullptr;
+  wrapper->length = 0;
+  wrapper->width = 0;
+  wrapper->height = 0;
+  wrapper->id = 0;
+  wrapper->handle = 0;
+  wrapper->timestamp = timestamp;
+  wrapper->duplicate = true;
+  wrapper->state = FRAME_QUEUED;
+  if (!addPendingFrame(session, wrapper))
+  {
+    delete wrapper;
+    return false;
+  }
+  return true;
+}
+
+int32_t native::queueNextFrame(Napi::Env env, uint32_t handle, uint8_t* frame,
+  size_t length, int width, int height, int64_t timestamp, uint32_t& status)
+{
+  // Make sure the session exists
+  status = FRAME_STATUS_DROPPED;
+  shared_ptr<VideoSession> session = findSession(handle);
+  if (session == nullptr)
   {
     return -1;
   }
-  if (!gRecording)
+
+  // Stamp the frame with the current time if JavaScript didn't supply a timestamp
+  if (timestamp < 0)
+  {
+    timestamp = PipelineStats::now();
+  }
+
+  // Make room for the frame. A frame that doesn't fit is dropped, and is replaced by
+  // a copy of the previous frame if the policy is to duplicate
+  status = FRAME_STATUS_ACCEPTED;
+  if (!reserveFrame(session, length, status))
   {
+    session->droppedFrames += 1;
+    session->stats->addDroppedFrame();
+    status = FRAME_STATUS_DROPPED;
+    if ((session->overloadPolicy == OVERLOAD_POLICY_DUPLICATE_LAST) &&
+      queueDuplicateFrame(session, timestamp))
+    {
+      status = FRAME_STATUS_DUPLICATED;
+    }
     return -1;
   }
 
@@ -78,129 +337,450 @@ int32_t native::queueNextFrame(Napi::Env env, uint8_t* frame, size_t length, int
   wrapper->length = length;
   wrapper->width = width;
   wrapper->height = height;
-  wrapper->id = gNextFrameId++;
-  gPendingFrameQueue->addItem(wrapper);
-  return wrapper->id;
+  wrapper->id = session->nextFrameId;
+  wrapper->handle = 0;
+  wrapper->timestamp = timestamp;
+  wrapper->duplicate = false;
+  wrapper->state = FRAME_QUEUED;
+  if (!addPendingFrame(session, wrapper))
+  {
+    session->frameBudget->release(length);
+    session->droppedFrames += 1;
+    session->stats->addDroppedFrame();
+    status = FRAME_STATUS_DROPPED;
+    delete wrapper;
+    return -1;
+  }
+  return session->nextFrameId++;
+}
+
+bool native::acquireFrameBuffer(Napi::Env env, uint32_t handle, int width, int height,
+  uint32_t& bufferHandle, shared_ptr<FrameMemory>& memory)
+{
+  // Make sure the session exists and hand out the next free buffer from its pool
+  shared_ptr<VideoSession> session = findSession(handle);
+  if ((session == nullptr) || (width <= 0) || (height <= 0))
+  {
+    return false;
+  }
+  return session->framePool->acquire(width, height, bufferHandle, memory);
 }
 
-vector<int32_t> native::checkCompletedFrames(Napi::Env env)
+void native::releaseFrameBuffer(Napi::Env env, uint32_t handle, uint32_t bufferHandle)
 {
-  printf("## checkCompletedFrames()\n");
-  fflush(stdout);
+  // Give an acquired buffer back to the pool without submitting it
+  shared_ptr<VideoSession> session = findSession(handle);
+  if (session != nullptr)
+  {
+    session->framePool->release(bufferHandle);
+  }
+}
+
+int32_t native::submitFrame(Napi::Env env, uint32_t handle, uint32_t bufferHandle,
+  int64_t timestamp)
+{
+  // Make sure the session exists
+  shared_ptr<VideoSession> session = findSession(handle);
+  if (session == nullptr)
+  {
+    return -1;
+  }
+
+  // Look up the buffer and place it in the queue for the thread to process. The
+  // buffer will be returned to the pool by the thread once it has been written
+  FrameWrapper* wrapper = new FrameWrapper;
+  if (!session->framePool->submit(bufferHandle, wrapper->frame, wrapper->length,
+    wrapper->width, wrapper->height))
+  {
+    delete wrapper;
+    return -1;
+  }
+  wrapper->id = session->nextFrameId;
+  wrapper->handle = bufferHandle;
+  wrapper->timestamp = (timestamp < 0) ? PipelineStats::now() : timestamp;
+  wrapper->duplicate = false;
+  wrapper->state = FRAME_QUEUED;
+  if (!addPendingFrame(session, wrapper))
+  {
+    session->framePool->release(bufferHandle);
+    delete wrapper;
+    return -1;
+  }
+  return session->nextFrameId++;
+}
 
-  // Return an array of all frames that we're done with and free the associated memory
+// Returns the IDs of all frames that the session is done with and frees the
+// associated memory. Duplicates don't belong to JavaScript so they aren't reported
+static vector<int32_t> takeCompletedFrames(shared_ptr<VideoSession> session)
+{
+  vector<FrameWrapper*> wrappers = session->completedFrameQueue->waitAllItems(0);
   vector<int32_t> ret;
-  FrameWrapper* wrapper;
-  while (gCompletedFrameQueue->waitItem(&wrapper, 0))
+  ret.reserve(wrappers.size());
+  for (FrameWrapper* wrapper : wrappers)
   {
-    ret.push_back(wrapper->id);
+    deque<FrameWrapper*>& queuedFrames = session->queuedFrames;
+    auto it = find(queuedFrames.begin(), queuedFrames.end(), wrapper);
+    if (it != queuedFrames.end())
+    {
+      queuedFrames.erase(it);
+    }
+    if (!wrapper->duplicate)
+    {
+      session->stats->recordStage(STAGE_COMPLETION_TO_RELEASE, wrapper->completedTime);
+      ret.push_back(wrapper->id);
+    }
     delete wrapper;
   }
   return ret;
 }
 
-void native::closeVideoOutput(Napi::Env env)
+uint64_t native::getDroppedFrames(Napi::Env env, uint32_t handle)
+{
+  shared_ptr<VideoSession> session = findSession(handle);
+  if (session == nullptr)
+  {
+    return 0;
+  }
+  return session->droppedFrames;
+}
+
+bool native::getStats(Napi::Env env, uint32_t handle, bool reset, StatsSnapshot& stats,
+  uint32_t& queueDepth, uint64_t& queuedBytes)
+{
+  shared_ptr<VideoSession> session = findSession(handle);
+  if (session == nullptr)
+  {
+    return false;
+  }
+  stats = session->stats->getSnapshot();
+  queueDepth = session->pendingFrameQueue->size();
+  queuedBytes = session->frameBudget->getQueuedBytes();
+  if (reset)
+  {
+    session->stats->reset();
+  }
+  return true;
+}
+
+bool native::getEncoderProgress(Napi::Env env, uint32_t handle,
+  EncoderProgress& progress)
+{
+  shared_ptr<VideoSession> session = findSession(handle);
+  if (session == nullptr)
+  {
+    return false;
+  }
+  return session->videoEncoder->getProgress(progress);
+}
+
+vector<int32_t> native::checkCompletedFrames(Napi::Env env, uint32_t handle)
+{
+  shared_ptr<VideoSession> session = findSession(handle);
+  if (session == nullptr)
+  {
+    return vector<int32_t>();
+  }
+  return takeCompletedFrames(session);
+}
+
+// Called on the JavaScript thread to pass all of a session's completed frames to the
+// callback
+static void deliverCompletedFrames(Napi::Env env, Napi::Function callback,
+  shared_ptr<VideoSession> session)
 {
-  if (!gRecording)
+  // Clear the pending flag before draining the queue so any frame completed after
+  // this point schedules another call
+  session->completionCallPending = false;
+  vector<int32_t> completedIds = takeCompletedFrames(session);
+  if (completedIds.empty())
   {
     return;
   }
-  if (gFrameThread != nullptr)
+  Napi::Int32Array ids = Napi::Int32Array::New(env, completedIds.size());
+  memcpy(ids.Data(), completedIds.data(), sizeof(int32_t) * completedIds.size());
+  callback.Call({ids});
+}
+
+// Called on the frame thread each time a frame is completed. Only one call is
+// scheduled at a time so frames that complete in quick succession are batched
+static void scheduleCompletedFrames(shared_ptr<VideoSession> session)
+{
+  if (!session->completionCallPending.exchange(true))
   {
-    if (gFrameThread->isRunning())
-    {
-      gFrameThread->terminate();
-    }
-    gFrameThread = nullptr;
+    session->completionCallback.NonBlockingCall(
+      [session](Napi::Env env, Napi::Function callback)
+      {
+        deliverCompletedFrames(env, callback, session);
+      });
+  }
+}
+
+static void releaseCompletionCallback(shared_ptr<VideoSession> session)
+{
+  if (!session->completionCallbackSet)
+  {
+    return;
+  }
+  session->frameThread->setCompletionListener(nullptr);
+
+  // Deliver anything that completed since the last call. Calls queued before the
+  // function is released are still made
+  session->completionCallPending = false;
+  scheduleCompletedFrames(session);
+  session->completionCallback.Release();
+  session->completionCallbackSet = false;
+}
+
+string native::onFramesCompleted(Napi::Env env, uint32_t handle, Napi::Function callback)
+{
+  // Make sure the session exists and replace any existing callback
+  shared_ptr<VideoSession> session = findSession(handle);
+  if (session == nullptr)
+  {
+    return "Create video output before registering callback";
   }
-  if (gFfmpegProcess != nullptr)
+  releaseCompletionCallback(session);
+  if (callback.IsEmpty())
+  {
+    return "";
+  }
+
+  // Create a thread-safe function that the frame thread can use to notify us. The
+  // listener holds a weak reference so the session can be freed once it's closed
+  session->completionCallback = Napi::ThreadSafeFunction::New(env, callback,
+    "onFramesCompleted", 0, 1);
+  session->completionCallbackSet = true;
+  session->completionCallPending = false;
+  weak_ptr<VideoSession> weakSession = session;
+  session->frameThread->setCompletionListener([weakSession]()
   {
-    if (gFfmpegProcess->isProcessRunning())
+    shared_ptr<VideoSession> session = weakSession.lock();
+    if (session != nullptr)
     {
-      gFfmpegProcess->waitForExit();
+      scheduleCompletedFrames(session);
     }
-    gFfmpegProcess = nullptr;
+  });
+
+  // Pick up any frames that completed before the callback was registered
+  scheduleCompletedFrames(session);
+  return "";
+}
+
+bool native::closeVideoOutput(Napi::Env env, uint32_t handle, int32_t& exitCode)
+{
+  shared_ptr<VideoSession> session = findSession(handle);
+  if (session == nullptr)
+  {
+    return false;
   }
-  gRecording = false;
+  gSessions.erase(handle);
+
+  // Let the frame thread write every queued frame before finishing the encoder on this
+  // thread. Cancelling it could leave the encoder half way through a frame
+  session->frameThread->finish();
+  releaseCompletionCallback(session);
+  session->frameThread = nullptr;
+  session->videoEncoder->finish();
+  bool exited = session->videoEncoder->getExitCode(exitCode);
+  session->videoEncoder = nullptr;
+  session->framePool = nullptr;
+  return exited;
 }
 
-string native::createPreviewChannel(Napi::Env env, string& channelName)
+string native::createPreviewChannel(Napi::Env env, uint32_t handle, string& channelName)
 {
-  // Make sure the main thread is running
-  if (gFrameThread == nullptr)
+  // Make sure the session exists
+  shared_ptr<VideoSession> session = findSession(handle);
+  if (session == nullptr)
   {
     return "Create video output before preview channel";
   }
+  shared_ptr<FrameThread> frameThread = session->frameThread;
+
+  // Prefer a shared memory ring sized for the frame thread's frames and pass it to the
+  // frame thread
+  string sharedMemoryName;
+  if (platform::generateUniqueSharedMemoryName(sharedMemoryName))
+  {
+    shared_ptr<SharedFrameRing> ring(new SharedFrameRing(sharedMemoryName));
+    if (ring->create(frameThread->getWidth() * frameThread->getHeight() * 4))
+    {
+      frameThread->setPreviewRing(ring);
+      channelName = SHARED_FRAME_RING_PREFIX + sharedMemoryName;
+      return "";
+    }
+  }
 
-  // Generate a unique pipe name and pass it to the frame thread
+  // Fall back to a named pipe if shared memory isn't available. Generate a unique
+  // pipe name and pass it to the frame thread
   if (!platform::generateUniquePipeName(channelName))
   {
     return "Failed to create uniquely named pipe";
   }
-  gFrameThread->setPreviewChannel(channelName);
+  frameThread->setPreviewChannel(channelName);
   return "";
 }
 
 string native::openPreviewChannel(Napi::Env env, string name)
 {
-  // Spawn the thread that will read frames from the remote frame thread
+  // Spawn the thread that will read frames from the remote frame thread. Only one
+  // thread may publish to the preview buffer, so stop any thread that's already running
+  closePreviewChannel(env);
   gPreviewThread = shared_ptr<PreviewThread>(new PreviewThread(name,
-    gPreviewFrameQueue));
+    gPreviewFrameBuffer, gPreviewFramePool));
+  gPreviewThread->setMaxFrameRate(gPreviewMaxFps);
   gPreviewThread->spawn();
   return "";
 }
 
-bool native::getNextFrame(Napi::Env env, uint8_t*& frame, size_t& length,
-  int maxWidth, int maxHeight)
+// Encodes a preview frame in the requested format, writing straight into the vector
+// that will back the JavaScript array buffer
+static void encodePreviewFrame(Mat& frame, PreviewOptions& options,
+  vector<uint8_t>& output)
+{
+  switch (options.format)
+  {
+    case PREVIEW_FORMAT_RGBA:
+    {
+      // Swap the red and blue channels so the data can go straight into an ImageData
+      output.resize(frame.total() * 4);
+      Mat rgba(frame.rows, frame.cols, CV_8UC4, output.data());
+      cvtColor(frame, rgba, COLOR_BGRA2RGBA);
+      break;
+    }
+    case PREVIEW_FORMAT_QOI:
+      qoi::encode(frame.data, frame.step, frame.cols, frame.rows, output);
+      break;
+    case PREVIEW_FORMAT_JPEG:
+    {
+      vector<int> params = {IMWRITE_JPEG_QUALITY, (int)options.quality};
+      imencode(".jpg", frame, output, params);
+      break;
+    }
+    default:
+      imencode(".png", frame, output);
+      break;
+  }
+}
+
+bool native::getNextFrame(Napi::Env env, shared_ptr<vector<uint8_t>>& frame,
+  uint32_t& width, uint32_t& height, uint32_t& number, int maxWidth, int maxHeight,
+  PreviewOptions options)
 {
-  // Get all preview frames in the queue and discarding everything except the most
-  // recent frame. Return false if no frames are available
-  vector<Mat*> allFrames = gPreviewFrameQueue->waitAllItems(0);
-  if (allFrames.size() == 0)
+  shared_ptr<PreviewFrame> previewFrame = takeNextFrame(env, maxWidth, maxHeight,
+    options.newerThan);
+  if (previewFrame == nullptr)
   {
     return false;
   }
-  Mat* previewFrame = allFrames[allFrames.size() - 1];
-  uint32_t discardCount = 0;
-  for (uint32_t i = 0; i < (allFrames.size() - 1); ++i)
+  number = previewFrame->number;
+  if (findCachedPreview(number, maxWidth, maxHeight, options, frame, width, height))
   {
-    Mat* tempFrame = allFrames[i];
-    delete tempFrame;
-    discardCount += 1;
+    return true;
   }
+  frame = processPreviewFrame(previewFrame, width, height, maxWidth, maxHeight, options);
+  cachePreview(number, maxWidth, maxHeight, options, frame, width, height);
+  return true;
+}
 
-  // Use the standard approach to calculate the scaled size of the preview frame
-  double frameRatio = (double)previewFrame->cols / (double)previewFrame->rows;
-  double maxRatio = (double)maxWidth / (double)maxHeight;
-  uint32_t width, height;
-  if (frameRatio > maxRatio)
+shared_ptr<PreviewFrame> native::takeNextFrame(Napi::Env env, int maxWidth,
+  int maxHeight, int64_t newerThan)
+{
+  // Let the frame thread know how large the preview is so it can scale frames before
+  // sending them
+  if (gPreviewThread != nullptr)
   {
-    width = maxWidth;
-    height = (uint32_t)((double)previewFrame->rows * (double)maxWidth /
-      (double)previewFrame->cols);
+    gPreviewThread->setMaxSize(maxWidth, maxHeight);
   }
-  else
+
+  // Take the most recent preview frame. Older frames were recycled by the preview
+  // thread as newer ones arrived. The frame goes back to the pool once it's been
+  // replaced and any workers encoding it have finished
+  PreviewFrame* taken = nullptr;
+  bool fresh = gPreviewFrameBuffer->take(taken);
+  if (fresh)
+  {
+    shared_ptr<PreviewFramePool> pool = gPreviewFramePool;
+    gLatestPreviewFrame = shared_ptr<PreviewFrame>(taken, [pool](PreviewFrame* frame)
+    {
+      pool->release(frame);
+    });
+  }
+
+  // Return null if there's no new frame. Callers that pass the number of the last frame
+  // they showed get the latest frame again if it's newer than that
+  if (gLatestPreviewFrame == nullptr)
   {
-    height = maxHeight;
-    width = (uint32_t)((double)previewFrame->cols * (double)maxHeight /
-      (double)previewFrame->rows);
+    return nullptr;
   }
+  if (newerThan < 0)
+  {
+    return fresh ? gLatestPreviewFrame : nullptr;
+  }
+  return ((int64_t)gLatestPreviewFrame->number > newerThan) ? gLatestPreviewFrame :
+    nullptr;
+}
 
-  // Resize the preview frame and export it in the PNG format
-  Mat resizedFrame;
-  resize(*previewFrame, resizedFrame, Size2i(width, height), 0, 0,
-    INTER_LINEAR);
-  vector<uchar> pngFrame;
-  imencode(".png", resizedFrame, pngFrame);
+shared_ptr<vector<uint8_t>> native::processPreviewFrame(
+  shared_ptr<PreviewFrame> previewFrame, uint32_t& width, uint32_t& height,
+  int maxWidth, int maxHeight, PreviewOptions options)
+{
+  // Scale the preview frame to fit and encode it. Frames that came through shared
+  // memory have usually been scaled by the frame thread already. This doesn't touch
+  // any global state so it's safe to call from a worker thread
+  Mat& image = previewFrame->image;
+  downscale::fitWithin(image.cols, image.rows, maxWidth, maxHeight, width, height);
+  Mat resizedFrame = image;
+  if ((width != (uint32_t)image.cols) || (height != (uint32_t)image.rows))
+  {
+    resize(image, resizedFrame, Size2i(width, height), 0, 0, INTER_LINEAR);
+  }
+  shared_ptr<vector<uint8_t>> frame(new vector<uint8_t>());
+  encodePreviewFrame(resizedFrame, options, *frame);
+  return frame;
+}
 
-  // Create a copy of the PNG frame data and delete the preview frame
-  length = pngFrame.size();
-  frame = new uint8_t[length];
-  memcpy(frame, &pngFrame[0], length);
-  delete previewFrame;
+bool native::findCachedPreview(uint32_t number, int maxWidth, int maxHeight,
+  PreviewOptions options, shared_ptr<vector<uint8_t>>& frame, uint32_t& width,
+  uint32_t& height)
+{
+  if ((gPreviewCache.data == nullptr) || (gPreviewCache.number != number) ||
+    (gPreviewCache.maxWidth != maxWidth) || (gPreviewCache.maxHeight != maxHeight) ||
+    (gPreviewCache.format != options.format) ||
+    (gPreviewCache.quality != options.quality))
+  {
+    return false;
+  }
+  frame = gPreviewCache.data;
+  width = gPreviewCache.width;
+  height = gPreviewCache.height;
   return true;
 }
 
+void native::cachePreview(uint32_t number, int maxWidth, int maxHeight,
+  PreviewOptions options, shared_ptr<vector<uint8_t>> frame, uint32_t width,
+  uint32_t height)
+{
+  gPreviewCache.number = number;
+  gPreviewCache.maxWidth = maxWidth;
+  gPreviewCache.maxHeight = maxHeight;
+  gPreviewCache.format = options.format;
+  gPreviewCache.quality = options.quality;
+  gPreviewCache.width = width;
+  gPreviewCache.height = height;
+  gPreviewCache.data = frame;
+}
+
+void native::setPreviewFrameRate(Napi::Env env, uint32_t maxFps)
+{
+  // Remember the frame rate so it also applies to channels opened later
+  gPreviewMaxFps = maxFps;
+  if (gPreviewThread != nullptr)
+  {
+    gPreviewThread->setMaxFrameRate(maxFps);
+  }
+}
+
 void native::closePreviewChannel(Napi::Env env)
 {
   if (gPreviewThread != nullptr)
@@ -211,9 +791,23 @@ void native::closePreviewChannel(Napi::Env env)
     }
     gPreviewThread = nullptr;
   }
+
+  // Frame numbers start again with the next channel so forget the last frame
+  PreviewFrame* frame = nullptr;
+  if (gPreviewFrameBuffer->take(frame))
+  {
+    gPreviewFramePool->release(frame);
+  }
+  gLatestPreviewFrame = nullptr;
+  gPreviewCache.data = nullptr;
+}
+
+void native::deleteFrameMemory(napi_env env, void* finalize_data, void* finalize_hint)
+{
+  delete reinterpret_cast<shared_ptr<FrameMemory>*>(finalize_hint);
 }
 
 void native::deletePreviewFrame(napi_env env, void* finalize_data, void* finalize_hint)
 {
-  delete[] reinterpret_cast<uint8_t*>(finalize_data);
+  delete reinterpret_cast<shared_ptr<vector<uint8_t>>*>(finalize_hint);
 }
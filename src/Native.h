@@ -2,24 +2,64 @@
 // They are invoked by the functions in Wrapper.h.
 
 #include <napi.h>
+#include <memory>
 #include <vector>
+#include <opencv2/core/core.hpp>
+#include "FfmpegProgress.h"
+#include "FramePool.h"
+#include "PipelineStats.h"
+#include "PreviewFramePool.h"
+#include "PreviewOptions.h"
+#include "VideoOptions.h"
+
+// Define constants for what happened to a frame passed to queueNextFrame()
+#define FRAME_STATUS_ACCEPTED 0
+#define FRAME_STATUS_DELAYED 1
+#define FRAME_STATUS_DROPPED 2
+#define FRAME_STATUS_DUPLICATED 3
 
 namespace native
 {
   void initializeFfmpeg(Napi::Env env, std::string ffmpegPath);
 
   std::string createVideoOutput(Napi::Env env, int width, int height, int fps,
-    std::string encoder, std::string outputPath);
-  int32_t queueNextFrame(Napi::Env env, uint8_t* frame, size_t length, int width,
-    int height);
-  std::vector<int32_t> checkCompletedFrames(Napi::Env env);
-  void closeVideoOutput(Napi::Env env);
+    std::string encoder, std::string outputPath, VideoOptions options,
+    uint32_t& handle);
+  int32_t queueNextFrame(Napi::Env env, uint32_t handle, uint8_t* frame, size_t length,
+    int width, int height, int64_t timestamp, uint32_t& status);
+  bool acquireFrameBuffer(Napi::Env env, uint32_t handle, int width, int height,
+    uint32_t& bufferHandle, std::shared_ptr<FrameMemory>& memory);
+  void releaseFrameBuffer(Napi::Env env, uint32_t handle, uint32_t bufferHandle);
+  int32_t submitFrame(Napi::Env env, uint32_t handle, uint32_t bufferHandle,
+    int64_t timestamp);
+  std::vector<int32_t> checkCompletedFrames(Napi::Env env, uint32_t handle);
+  uint64_t getDroppedFrames(Napi::Env env, uint32_t handle);
+  bool getStats(Napi::Env env, uint32_t handle, bool reset, StatsSnapshot& stats,
+    uint32_t& queueDepth, uint64_t& queuedBytes);
+  bool getEncoderProgress(Napi::Env env, uint32_t handle, EncoderProgress& progress);
+  std::string onFramesCompleted(Napi::Env env, uint32_t handle,
+    Napi::Function callback);
+  bool closeVideoOutput(Napi::Env env, uint32_t handle, int32_t& exitCode);
 
-  std::string createPreviewChannel(Napi::Env env, std::string& channelName);
+  std::string createPreviewChannel(Napi::Env env, uint32_t handle,
+    std::string& channelName);
   std::string openPreviewChannel(Napi::Env env, std::string name);
-  bool getNextFrame(Napi::Env env, uint8_t*& frame, size_t& length, int maxWidth,
-    int maxHeight);
+  bool getNextFrame(Napi::Env env, std::shared_ptr<std::vector<uint8_t>>& frame,
+    uint32_t& width, uint32_t& height, uint32_t& number, int maxWidth, int maxHeight,
+    PreviewOptions options);
+  std::shared_ptr<PreviewFrame> takeNextFrame(Napi::Env env, int maxWidth,
+    int maxHeight, int64_t newerThan);
+  std::shared_ptr<std::vector<uint8_t>> processPreviewFrame(
+    std::shared_ptr<PreviewFrame> previewFrame, uint32_t& width, uint32_t& height,
+    int maxWidth, int maxHeight, PreviewOptions options);
+  bool findCachedPreview(uint32_t number, int maxWidth, int maxHeight,
+    PreviewOptions options, std::shared_ptr<std::vector<uint8_t>>& frame,
+    uint32_t& width, uint32_t& height);
+  void cachePreview(uint32_t number, int maxWidth, int maxHeight, PreviewOptions options,
+    std::shared_ptr<std::vector<uint8_t>> frame, uint32_t width, uint32_t height);
+  void setPreviewFrameRate(Napi::Env env, uint32_t maxFps);
   void closePreviewChannel(Napi::Env env);
 
+  void deleteFrameMemory(napi_env env, void* finalize_data, void* finalize_hint);
   void deletePreviewFrame(napi_env env, void* finalize_data, void* finalize_hint);
 }
@@ -5,7 +5,9 @@ using namespace std;
 
 PipeReader::PipeReader(string name, uint32_t f) :
   Thread(name),
-  file(f)
+  file(f),
+  watchToken(0),
+  closed(false)
 {
 }
 
@@ -17,51 +19,122 @@ string PipeReader::getData()
   return ret;
 }
 
-uint32_t PipeReader::run()
+void PipeReader::setLineListener(function<void(const string&)> listener)
 {
-  printf("[PipeReader] ## Spawning pipe reader, checkForExit = %i\n", checkForExit());
+  lineListener = listener;
+}
 
-  char buffer[1024];
-  while (!checkForExit())
-  {
-    printf("[PipeReader] ## A\n");
+void PipeReader::setCloseListener(function<void()> listener)
+{
+  closeListener = listener;
+}
 
-    // Wait for data to become available to read and continue around the loop if nothing
-    // arrives within 100 ms
-    int32_t ret = platform::waitForData(file, 100);
-    if (ret == -1)
+bool PipeReader::watch(shared_ptr<Reactor> r)
+{
+  reactor = r;
+  watchToken = reactor->watchFile(file, false, [this]()
+  {
+    if (!readAvailable())
     {
-      printf("[PipeReader] Failed to read from pipe\n");
-      return 0;
+      unwatch();
+      markClosed();
     }
-    else if (ret == 0)
+  });
+  if (watchToken == 0)
+  {
+    reactor = nullptr;
+    return false;
+  }
+  return true;
+}
+
+void PipeReader::unwatch()
+{
+  uint64_t token = watchToken.exchange(0);
+  if (token != 0)
+  {
+    reactor->unwatch(token);
+  }
+}
+
+bool PipeReader::isOpen()
+{
+  return !closed;
+}
+
+bool PipeReader::readAvailable()
+{
+  // Read whatever is in the pipe. Returns false once the other end has been closed
+  char buffer[4096];
+  int32_t ret = platform::read(file, (uint8_t*)&(buffer[0]), sizeof(buffer));
+  if (ret == -1)
+  {
+    printf("[PipeReader] Failed to read from pipe\n");
+    return false;
+  }
+  else if (ret == 0)
+  {
+    return false;
+  }
+  appendData(buffer, ret);
+  return true;
+}
+
+void PipeReader::markClosed()
+{
+  if (!closed.exchange(true) && closeListener)
+  {
+    closeListener();
+  }
+}
+
+void PipeReader::appendData(const char* buffer, uint32_t length)
+{
+  if (!lineListener)
+  {
+    unique_lock<mutex> lock(dataMutex);
+    data.append(buffer, length);
+    if (data.size() > PIPE_READER_MAX_BYTES)
     {
-      continue;
+      data.erase(0, data.size() - PIPE_READER_MAX_BYTES);
     }
+    return;
+  }
 
-    printf("[PipeReader] ## B\n");
+  // Pass each complete line to the listener and hold on to the rest until the next
+  // read. Lines may end with a carriage return on Windows
+  partialLine.append(buffer, length);
+  size_t start = 0, end;
+  while ((end = partialLine.find('\n', start)) != string::npos)
+  {
+    size_t lineEnd = ((end > start) && (partialLine[end - 1] == '\r')) ? end - 1 : end;
+    lineListener(partialLine.substr(start, lineEnd - start));
+    start = end + 1;
+  }
+  partialLine.erase(0, start);
+  if (partialLine.size() > PIPE_READER_MAX_BYTES)
+  {
+    partialLine.clear();
+  }
+}
 
-    // Read data from the pipe and append it to the data string
-    ret = platform::read(file, (uint8_t*)&(buffer[0]), 1023);
+uint32_t PipeReader::run()
+{
+  // Wait for data to become available to read and continue around the loop if nothing
+  // arrives within 100 ms, which is how often we check whether to exit
+  while (!checkForExit())
+  {
+    int32_t ret = platform::waitForData(file, 100);
     if (ret == -1)
     {
       printf("[PipeReader] Failed to read from pipe\n");
-      return 0;
-    }
-    else if (ret == 0)
-    {
       break;
     }
-    else if (ret > 0)
+    else if ((ret != 0) && !readAvailable())
     {
-      buffer[ret] = 0;
-      unique_lock<mutex> lock(dataMutex);
-      data += buffer;
+      break;
     }
-
-    printf("[PipeReader] ## C\n");
   }
-
-  printf("[PipeReader] ## Pipe reader exiting\n");
+  markClosed();
   return 0;
 }
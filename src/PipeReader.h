@@ -1,10 +1,21 @@
 #pragma once
 
+#include <atomic>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <string>
+#include "Reactor.h"
 #include "Thread.h"
 
+// The most output that is kept for getData(). Older output is discarded so a chatty
+// process can't use up memory during a long recording
+#define PIPE_READER_MAX_BYTES (64 * 1024)
+
+// This class reads the output of a child process, either from the shared reactor or,
+// where that isn't available, on a thread of its own. The output is either kept for
+// getData(), up to a limit, or split into lines and passed to a listener as it
+// arrives.
 class PipeReader : public Thread
 {
 public:
@@ -13,11 +24,33 @@ public:
 
 public:
   std::string getData();
+
+  // Both listeners must be set before reading starts. The close listener is called
+  // once the other end of the pipe has been closed
+  void setLineListener(std::function<void(const std::string&)> listener);
+  void setCloseListener(std::function<void()> listener);
+
+  // Reads the pipe from the reactor instead of spawning a thread. Returns false if the
+  // reactor can't watch the pipe
+  bool watch(std::shared_ptr<Reactor> reactor);
+  void unwatch();
+  bool isOpen();
+
   uint32_t run();
 
 private:
+  bool readAvailable();
+  void appendData(const char* buffer, uint32_t length);
+  void markClosed();
+
   uint32_t file = 0;
   std::string data;
+  std::string partialLine;
+  std::function<void(const std::string&)> lineListener;
+  std::function<void()> closeListener;
+  std::shared_ptr<Reactor> reactor;
+  std::atomic<uint64_t> watchToken;
+  std::atomic<bool> closed;
   std::mutex dataMutex;
 };
 
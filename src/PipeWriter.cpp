@@ -0,0 +1,140 @@
+#include "PipeWriter.h"
+#include "Platform.h"
+
+using namespace std;
+
+PipeWriter::PipeWriter(uint64_t f) :
+  file(f)
+{
+  // Only write without blocking if the reactor can finish the writes for us
+  shared_ptr<Reactor> shared = Reactor::shared();
+  if ((shared != nullptr) && platform::setNonBlocking(file))
+  {
+    reactor = shared;
+  }
+}
+
+PipeWriter::~PipeWriter()
+{
+  uint64_t token = 0;
+  {
+    unique_lock<mutex> lock(writeMutex);
+    token = watchToken;
+    watchToken = 0;
+  }
+  if (token != 0)
+  {
+    reactor->unwatch(token);
+  }
+}
+
+bool PipeWriter::writeFrame(const string& header, const uint8_t* data,
+  uint32_t length, bool& skipped)
+{
+  skipped = false;
+  if (reactor == nullptr)
+  {
+    return writeAll((const uint8_t*)header.data(), header.size()) &&
+      writeAll(data, length);
+  }
+
+  unique_lock<mutex> lock(writeMutex);
+  if (failed)
+  {
+    return false;
+  }
+  if (pendingOffset < pending.size())
+  {
+    skipped = true;
+    return true;
+  }
+
+  // Write as much as the pipe will take and keep a copy of the remainder
+  const uint8_t* parts[] = {(const uint8_t*)header.data(), data};
+  uint32_t lengths[] = {(uint32_t)header.size(), length};
+  pending.clear();
+  pendingOffset = 0;
+  for (uint32_t i = 0; i < 2; ++i)
+  {
+    uint32_t written = 0;
+    if (pending.empty())
+    {
+      while (written < lengths[i])
+      {
+        int32_t ret = platform::writeNonBlocking(file, parts[i] + written,
+          lengths[i] - written);
+        if (ret == -1)
+        {
+          failed = true;
+          return false;
+        }
+        if (ret == 0)
+        {
+          break;
+        }
+        written += ret;
+      }
+    }
+    if (written < lengths[i])
+    {
+      pending.insert(pending.end(), parts[i] + written, parts[i] + lengths[i]);
+    }
+  }
+
+  // Have the reactor finish the frame when the pipe has room
+  if (!pending.empty() && (watchToken == 0))
+  {
+    watchToken = reactor->watchFile(file, true, [this]()
+    {
+      flushPending();
+    });
+    if (watchToken == 0)
+    {
+      failed = true;
+      return false;
+    }
+  }
+  return true;
+}
+
+void PipeWriter::flushPending()
+{
+  // Called on the reactor thread whenever the pipe has room
+  unique_lock<mutex> lock(writeMutex);
+  while (pendingOffset < pending.size())
+  {
+    int32_t ret = platform::writeNonBlocking(file, pending.data() + pendingOffset,
+      pending.size() - pendingOffset);
+    if (ret == -1)
+    {
+      failed = true;
+      break;
+    }
+    if (ret == 0)
+    {
+      return;
+    }
+    pendingOffset += ret;
+  }
+
+  // Stop watching once the frame has been written, otherwise the reactor would be
+  // woken continuously while the pipe is empty. This is done before the lock is
+  // released so the next frame can watch the pipe again
+  reactor->unwatch(watchToken);
+  watchToken = 0;
+}
+
+bool PipeWriter::writeAll(const uint8_t* buffer, uint32_t length)
+{
+  uint32_t bytesWritten = 0;
+  while (bytesWritten < length)
+  {
+    int32_t ret = platform::write(file, buffer + bytesWritten, length - bytesWritten);
+    if (ret == -1)
+    {
+      return false;
+    }
+    bytesWritten += ret;
+  }
+  return true;
+}
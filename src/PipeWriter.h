@@ -0,0 +1,36 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Reactor.h"
+
+// This class writes preview frames to a named pipe without holding up the frame
+// thread. As much of each frame as the pipe will take is written straight away and
+// the reactor writes the rest once the renderer has read enough to make room. New
+// frames are skipped until the previous frame has been written, so a slow renderer
+// only makes the preview drop frames. Without a reactor the writes block as before.
+class PipeWriter
+{
+public:
+  PipeWriter(uint64_t file);
+  virtual ~PipeWriter();
+
+  // Writes the header followed by the frame. Returns false if the pipe has failed and
+  // sets skipped if the frame was dropped because the last one is still being written
+  bool writeFrame(const std::string& header, const uint8_t* data, uint32_t length,
+    bool& skipped);
+
+private:
+  bool writeAll(const uint8_t* buffer, uint32_t length);
+  void flushPending();
+
+  uint64_t file;
+  std::shared_ptr<Reactor> reactor;
+  uint64_t watchToken = 0;
+  std::vector<uint8_t> pending;
+  size_t pendingOffset = 0;
+  bool failed = false;
+  std::mutex writeMutex;
+};
@@ -0,0 +1,89 @@
+#include "PipelineStats.h"
+#include <chrono>
+
+using namespace std;
+
+PipelineStats::PipelineStats()
+{
+  reset();
+}
+
+int64_t PipelineStats::now()
+{
+  return chrono::duration_cast<chrono::microseconds>(
+    chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+const char* PipelineStats::stageName(uint32_t stage)
+{
+  switch (stage)
+  {
+    case STAGE_QUEUE_WAIT:
+      return "queueWait";
+    case STAGE_RESIZE:
+      return "resize";
+    case STAGE_ENCODER_WRITE:
+      return "encoderWrite";
+    case STAGE_PREVIEW_WRITE:
+      return "previewWrite";
+    case STAGE_COMPLETION_TO_RELEASE:
+      return "completionToRelease";
+  }
+  return "";
+}
+
+int64_t PipelineStats::recordStage(uint32_t stage, int64_t start)
+{
+  int64_t end = now();
+  stages[stage].record(end - start);
+  return end;
+}
+
+void PipelineStats::addQueuedFrame(uint32_t queueDepth)
+{
+  queuedFrames.fetch_add(1, memory_order_relaxed);
+  uint32_t current = maxQueueDepth.load(memory_order_relaxed);
+  while ((queueDepth > current) &&
+    !maxQueueDepth.compare_exchange_weak(current, queueDepth, memory_order_relaxed))
+  {
+  }
+}
+
+void PipelineStats::addWrittenFrame(uint64_t bytes)
+{
+  writtenFrames.fetch_add(1, memory_order_relaxed);
+  writtenBytes.fetch_add(bytes, memory_order_relaxed);
+}
+
+void PipelineStats::addDroppedFrame()
+{
+  droppedFrames.fetch_add(1, memory_order_relaxed);
+}
+
+StatsSnapshot PipelineStats::getSnapshot()
+{
+  StatsSnapshot snapshot;
+  snapshot.queuedFrames = queuedFrames.load(memory_order_relaxed);
+  snapshot.writtenFrames = writtenFrames.load(memory_order_relaxed);
+  snapshot.writtenBytes = writtenBytes.load(memory_order_relaxed);
+  snapshot.droppedFrames = droppedFrames.load(memory_order_relaxed);
+  snapshot.maxQueueDepth = maxQueueDepth.load(memory_order_relaxed);
+  for (uint32_t i = 0; i < STAGE_COUNT; ++i)
+  {
+    snapshot.stages[i] = stages[i].summarize();
+  }
+  return snapshot;
+}
+
+void PipelineStats::reset()
+{
+  for (uint32_t i = 0; i < STAGE_COUNT; ++i)
+  {
+    stages[i].reset();
+  }
+  queuedFrames.store(0, memory_order_relaxed);
+  writtenFrames.store(0, memory_order_relaxed);
+  writtenBytes.store(0, memory_order_relaxed);
+  droppedFrames.store(0, memory_order_relaxed);
+  maxQueueDepth.store(0, memory_order_relaxed);
+}
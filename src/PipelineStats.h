@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include "LatencyHistogram.h"
+
+// Define constants for the stages of the pipeline that are timed
+#define STAGE_QUEUE_WAIT 0
+#define STAGE_RESIZE 1
+#define STAGE_ENCODER_WRITE 2
+#define STAGE_PREVIEW_WRITE 3
+#define STAGE_COMPLETION_TO_RELEASE 4
+#define STAGE_COUNT 5
+
+typedef struct
+{
+  uint64_t queuedFrames;
+  uint64_t writtenFrames;
+  uint64_t writtenBytes;
+  uint64_t droppedFrames;
+  uint32_t maxQueueDepth;
+  HistogramSummary stages[STAGE_COUNT];
+} StatsSnapshot;
+
+// This class collects the timings and counters of one video output. The frame thread
+// and the JavaScript thread both record into it without locking, and JavaScript reads
+// and optionally resets it through getStats().
+class PipelineStats
+{
+public:
+  PipelineStats();
+  virtual ~PipelineStats() {};
+
+  // Returns the current time in microseconds on a monotonic clock
+  static int64_t now();
+  static const char* stageName(uint32_t stage);
+
+  // Records the time since the start of a stage and returns the current time so the
+  // next stage can start from it
+  int64_t recordStage(uint32_t stage, int64_t start);
+
+  void addQueuedFrame(uint32_t queueDepth);
+  void addWrittenFrame(uint64_t bytes);
+  void addDroppedFrame();
+
+  StatsSnapshot getSnapshot();
+  void reset();
+
+private:
+  LatencyHistogram stages[STAGE_COUNT];
+  std::atomic<uint64_t> queuedFrames;
+  std::atomic<uint64_t> writtenFrames;
+  std::atomic<uint64_t> writtenBytes;
+  std::atomic<uint64_t> droppedFrames;
+  std::atomic<uint32_t> maxQueueDepth;
+};
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -14,6 +16,12 @@ namespace platform
   bool isProcessRunning(uint64_t pid);
   bool terminateProcess(uint64_t pid, uint32_t exitCode);
 
+  // Blocks until the process exits. The process isn't reaped so its pid can't be reused
+  // until reapProcess() returns its exit code, which is 128 plus the signal number if
+  // it was killed by a signal
+  bool waitForProcess(uint64_t pid);
+  bool reapProcess(uint64_t pid, int32_t& exitCode);
+
   bool spawnThread(runFunction func, void* context, uint64_t& threadId);
   bool terminateThread(uint64_t threadId, uint32_t exitCode);
 
@@ -24,8 +32,40 @@ namespace platform
   bool openNamedPipeForReading(std::string channelName, uint64_t& pipeId);
   void closeNamedPipeForReading(uint64_t pipeId);
 
+  bool generateUniqueSharedMemoryName(std::string& name);
+  bool createSharedMemory(std::string name, size_t length, uint64_t& memoryId,
+    uint8_t*& memory);
+  bool openSharedMemory(std::string name, uint64_t& memoryId, uint8_t*& memory,
+    size_t& length);
+  void closeSharedMemory(std::string name, uint64_t memoryId, uint8_t* memory,
+    size_t length, bool owner);
+  bool waitOnSharedValue(std::atomic<uint32_t>* value, uint32_t expected,
+    uint32_t timeoutMs);
+  void wakeSharedValue(std::atomic<uint32_t>* value);
+
+  uint8_t* allocatePages(size_t length);
+  void freePages(uint8_t* pages, size_t length);
+
   int32_t waitForData(uint64_t file, uint32_t timeoutMs);
   int32_t read(uint64_t file, uint8_t* buffer, uint32_t maxLength);
   int32_t write(uint64_t file, const uint8_t* buffer, uint32_t length);
   void close(uint64_t file);
+
+  // Writes as much as the file will take without blocking. Returns the number of bytes
+  // written, which is zero if the file is full, or -1 on error
+  bool setNonBlocking(uint64_t file);
+  int32_t writeNonBlocking(uint64_t file, const uint8_t* buffer, uint32_t length);
+
+  // An event loop waits on many files and processes at once using epoll on Linux and
+  // kqueue on Mac. Each watch is identified by a token that waitForEvents() returns
+  // when it's ready. Event loops aren't supported on Windows, where createEventLoop()
+  // returns false
+  bool createEventLoop(uint64_t& loopId);
+  void closeEventLoop(uint64_t loopId);
+  bool watchFile(uint64_t loopId, uint64_t file, bool forWriting, uint64_t token);
+  void unwatchFile(uint64_t loopId, uint64_t file, bool forWriting);
+  bool watchProcess(uint64_t loopId, uint64_t pid, uint64_t token, uint64_t& watchId);
+  void unwatchProcess(uint64_t loopId, uint64_t watchId);
+  bool wakeEventLoop(uint64_t loopId);
+  bool waitForEvents(uint64_t loopId, std::vector<uint64_t>& tokens);
 }
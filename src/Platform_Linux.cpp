@@ -0,0 +1,617 @@
+#include "Platform.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+using namespace std;
+
+extern char** environ;
+
+#define PIPE_READ 0
+#define PIPE_WRITE 1
+
+// The token of the eventfd that wakes an event loop
+#define WAKE_TOKEN UINT64_MAX
+
+// The default pipe capacity on Linux is 64 KiB, which means a single 1080p BGRA frame
+// takes well over a hundred round trips through the kernel. Ask for 1 MiB, which is
+// the default value of /proc/sys/fs/pipe-max-size for unprivileged processes
+#define PIPE_CAPACITY (1024 * 1024)
+
+// Attempts to raise the capacity of the given pipe. Failure isn't fatal because the
+// pipe continues to work with its default capacity
+static void growPipe(int fd)
+{
+  if (fcntl(fd, F_SETPIPE_SZ, PIPE_CAPACITY) != -1)
+  {
+    return;
+  }
+
+  // The system limit may have been lowered by the administrator. Fall back to the
+  // largest size we're allowed to ask for
+  if (errno == EPERM)
+  {
+    FILE* file = fopen("/proc/sys/fs/pipe-max-size", "r");
+    if (file != NULL)
+    {
+      int maxSize = 0;
+      if ((fscanf(file, "%d", &maxSize) == 1) && (maxSize > 0))
+      {
+        fcntl(fd, F_SETPIPE_SZ, maxSize);
+      }
+      fclose(file);
+    }
+  }
+}
+
+static void closePipe(int pipe[2])
+{
+  if (pipe[PIPE_READ] != -1)
+  {
+    close(pipe[PIPE_READ]);
+  }
+  if (pipe[PIPE_WRITE] != -1)
+  {
+    close(pipe[PIPE_WRITE]);
+  }
+}
+
+void platform::sleep(uint32_t timeMs)
+{
+  usleep(timeMs * 1000);
+}
+
+bool platform::spawnProcess(string executable, vector<string> arguments,
+  uint64_t& pid, uint64_t& stdIn, uint64_t& stdOut, uint64_t& stdErr)
+{
+  // Build the argument and environment arrays before forking because the child of a
+  // multithreaded process may only call async-signal-safe functions
+  vector<char*> args, env;
+  args.push_back(&executable[0]);
+  for (vector<string>::iterator it = arguments.begin(); it != arguments.end();
+    ++it)
+  {
+    args.push_back(&(*it)[0]);
+  }
+  args.push_back(NULL);
+  for (int i = 0; *(environ + i) != 0; i++)
+  {
+    env.push_back(*(environ + i));
+  }
+  env.push_back(NULL);
+
+  // Create the pipes with the close-on-exec flag set so they don't leak into other
+  // processes that we spawn concurrently. The flag is cleared on the descriptors that
+  // dup2() installs as the child's standard streams
+  int stdinPipe[2] = {-1, -1}, stdoutPipe[2] = {-1, -1}, stderrPipe[2] = {-1, -1};
+  if ((pipe2(stdinPipe, O_CLOEXEC) < 0) || (pipe2(stdoutPipe, O_CLOEXEC) < 0) ||
+    (pipe2(stderrPipe, O_CLOEXEC) < 0))
+  {
+    closePipe(stdinPipe);
+    closePipe(stdoutPipe);
+    closePipe(stderrPipe);
+    printf("ERROR: Failed to allocate pipes\n");
+    return false;
+  }
+  growPipe(stdinPipe[PIPE_WRITE]);
+
+  int forkResult = fork();
+  if (forkResult == 0)
+  {
+    if ((dup2(stdinPipe[PIPE_READ], STDIN_FILENO) == -1) ||
+      (dup2(stdoutPipe[PIPE_WRITE], STDOUT_FILENO) == -1) ||
+      (dup2(stderrPipe[PIPE_WRITE], STDERR_FILENO) == -1))
+    {
+      _exit(errno);
+    }
+    execve(executable.c_str(), args.data(), env.data());
+    _exit(127);
+  }
+  else if (forkResult > 0)
+  {
+    pid = (uint64_t)forkResult;
+    stdIn = (uint64_t)stdinPipe[PIPE_WRITE];
+    stdOut = (uint64_t)stdoutPipe[PIPE_READ];
+    stdErr = (uint64_t)stderrPipe[PIPE_READ];
+    close(stdinPipe[PIPE_READ]);
+    close(stdoutPipe[PIPE_WRITE]);
+    close(stderrPipe[PIPE_WRITE]);
+    return true;
+  }
+  else
+  {
+    closePipe(stdinPipe);
+    closePipe(stdoutPipe);
+    closePipe(stderrPipe);
+    printf("ERROR: Failed to fork child\n");
+    return false;
+  }
+}
+
+bool platform::isProcessRunning(uint64_t pid)
+{
+  int status;
+  int res = waitpid((int)pid, &status, WNOHANG);
+  if (res == 0)
+  {
+    return true;
+  }
+  else if (res == (int)pid)
+  {
+    return false;
+  }
+  else if ((res == -1) && (errno == ECHILD))
+  {
+    return false;
+  }
+  else
+  {
+    printf("ERROR: Failed to check if child process is running\n");
+    return false;
+  }
+}
+
+bool platform::terminateProcess(uint64_t pid, uint32_t exitCode)
+{
+  return (kill((int)pid, SIGKILL) == 0);
+}
+
+bool platform::waitForProcess(uint64_t pid)
+{
+  siginfo_t info;
+  while (waitid(P_PID, (id_t)pid, &info, WEXITED | WNOWAIT) == -1)
+  {
+    if (errno != EINTR)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool platform::reapProcess(uint64_t pid, int32_t& exitCode)
+{
+  int status;
+  int res;
+  do
+  {
+    res = waitpid((int)pid, &status, 0);
+  } while ((res == -1) && (errno == EINTR));
+  if (res != (int)pid)
+  {
+    return false;
+  }
+  if (WIFEXITED(status))
+  {
+    exitCode = WEXITSTATUS(status);
+  }
+  else if (WIFSIGNALED(status))
+  {
+    exitCode = 128 + WTERMSIG(status);
+  }
+  else
+  {
+    return false;
+  }
+  return true;
+}
+
+typedef struct
+{
+  runFunction func;
+  void* context;
+} RUN_CONTEXT;
+void* runHelperLinux(void* context)
+{
+  RUN_CONTEXT* runContext = (RUN_CONTEXT*)context;
+  uint32_t ret = runContext->func(runContext->context);
+  delete runContext;
+  return reinterpret_cast<void*>(ret);
+}
+bool platform::spawnThread(runFunction func, void* context, uint64_t& threadId)
+{
+  RUN_CONTEXT* runContext = new RUN_CONTEXT;
+  runContext->func = func;
+  runContext->context = context;
+  pthread_t thread;
+  int retVal = pthread_create(&thread, nullptr, &runHelperLinux, runContext);
+  if (retVal != 0)
+  {
+    delete runContext;
+    return false;
+  }
+  threadId = (uint64_t)thread;
+  return true;
+}
+
+bool platform::terminateThread(uint64_t threadId, uint32_t exitCode)
+{
+  return (pthread_cancel((pthread_t)threadId) == 0);
+}
+
+bool platform::generateUniquePipeName(string& channelName)
+{
+  // Create a temporary file to reserve a unique name
+  char nameBuffer[128];
+  snprintf(nameBuffer, 128, "/tmp/eyeNativeXXXXXX");
+  int tmpFd = mkstemp(nameBuffer);
+  if (tmpFd == -1)
+  {
+    return false;
+  }
+  close(tmpFd);
+
+  // Append ".fifo" to the temporary file's name to make it unique and create a
+  // named pipe
+  channelName = string(nameBuffer) + ".fifo";
+  bool created = (mkfifo(channelName.c_str(), S_IRUSR | S_IWUSR | S_IWGRP |
+    S_IROTH | S_IWOTH) == 0);
+  unlink(nameBuffer);
+  return created;
+}
+
+bool platform::createNamedPipeForWriting(string channelName, uint64_t& pipeId,
+  bool& opening)
+{
+  // Attempt to create the named pipe in nonblocking mode. This will only succeed
+  // if the remote process has already opened the pipe for reading. We use this
+  // approach so we don't block forever waiting on the remote process
+  int pipe = open(channelName.c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+  if (pipe == -1)
+  {
+    // A response of ENXIO is expected and means the other end of the pipe hasn't
+    // been opened for reading, any other error code means something else went wrong
+    if (errno == ENXIO)
+    {
+      pipeId = 0;
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+  // Grow the pipe so each preview frame needs fewer trips through the kernel and
+  // switch it to blocking mode now that the other end is connected
+  growPipe(pipe);
+  int flags = fcntl(pipe, F_GETFL, 0);
+  flags &= ~O_NONBLOCK;
+  fcntl(pipe, F_SETFL, flags);
+
+  // Skip the opening state and go straight to open
+  pipeId = (uint64_t)pipe;
+  opening = false;
+  return true;
+}
+
+bool platform::openNamedPipeForWriting(uint64_t pipeId, bool& opened)
+{
+  // This shouldn't be called on Linux
+  return false;
+}
+
+void platform::closeNamedPipeForWriting(string channelName, uint64_t pipeId)
+{
+  ::close((int)pipeId);
+  unlink(channelName.c_str());
+}
+
+bool platform::openNamedPipeForReading(string channelName, uint64_t& pipeId)
+{
+  int ret = open(channelName.c_str(), O_RDONLY | O_CLOEXEC);
+  if (ret == -1)
+  {
+    return false;
+  }
+  pipeId = (uint64_t)ret;
+  return true;
+}
+
+void platform::closeNamedPipeForReading(uint64_t pipeId)
+{
+  ::close((int)pipeId);
+}
+
+bool platform::generateUniqueSharedMemoryName(string& name)
+{
+  // Combine the process ID with a counter so every channel gets its own object
+  static atomic<uint32_t> counter(0);
+  char nameBuffer[64];
+  snprintf(nameBuffer, 64, "/eyeNative%d_%u", (int)getpid(), counter++);
+  name = nameBuffer;
+  return true;
+}
+
+bool platform::createSharedMemory(string name, size_t length, uint64_t& memoryId,
+  uint8_t*& memory)
+{
+  // Create a new shared memory object, failing if one already exists with this name,
+  // and map it into our address space
+  int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,
+    S_IRUSR | S_IWUSR);
+  if (fd == -1)
+  {
+    return false;
+  }
+  if (ftruncate(fd, length) == -1)
+  {
+    ::close(fd);
+    shm_unlink(name.c_str());
+    return false;
+  }
+  void* mapped = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mapped == MAP_FAILED)
+  {
+    ::close(fd);
+    shm_unlink(name.c_str());
+    return false;
+  }
+  memoryId = (uint64_t)fd;
+  memory = (uint8_t*)mapped;
+  return true;
+}
+
+bool platform::openSharedMemory(string name, uint64_t& memoryId, uint8_t*& memory,
+  size_t& length)
+{
+  // Open the existing shared memory object and map all of it
+  int fd = shm_open(name.c_str(), O_RDWR | O_CLOEXEC, 0);
+  if (fd == -1)
+  {
+    return false;
+  }
+  struct stat info;
+  if ((fstat(fd, &info) == -1) || (info.st_size == 0))
+  {
+    ::close(fd);
+    return false;
+  }
+  void* mapped = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mapped == MAP_FAILED)
+  {
+    ::close(fd);
+    return false;
+  }
+  memoryId = (uint64_t)fd;
+  memory = (uint8_t*)mapped;
+  length = info.st_size;
+  return true;
+}
+
+void platform::closeSharedMemory(string name, uint64_t memoryId, uint8_t* memory,
+  size_t length, bool owner)
+{
+  // Processes that still have the object mapped keep using it after it's unlinked
+  munmap(memory, length);
+  ::close((int)memoryId);
+  if (owner)
+  {
+    shm_unlink(name.c_str());
+  }
+}
+
+bool platform::waitOnSharedValue(atomic<uint32_t>* value, uint32_t expected,
+  uint32_t timeoutMs)
+{
+  // Sleep on the futex until the value changes or the timeout expires. The shared
+  // variant is used because the other side is in another process
+  struct timespec timeout;
+  timeout.tv_sec = timeoutMs / 1000;
+  timeout.tv_nsec = (timeoutMs % 1000) * 1000000;
+  syscall(SYS_futex, (uint32_t*)value, FUTEX_WAIT, expected, &timeout, NULL, 0);
+  return (value->load() != expected);
+}
+
+void platform::wakeSharedValue(atomic<uint32_t>* value)
+{
+  syscall(SYS_futex, (uint32_t*)value, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
+
+uint8_t* platform::allocatePages(size_t length)
+{
+  void* pages = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+    -1, 0);
+  if (pages == MAP_FAILED)
+  {
+    return nullptr;
+  }
+  return (uint8_t*)pages;
+}
+
+void platform::freePages(uint8_t* pages, size_t length)
+{
+  munmap(pages, length);
+}
+
+int32_t platform::waitForData(uint64_t file, uint32_t timeoutMs)
+{
+  // Use poll() rather than select() because the latter can't handle descriptors
+  // above FD_SETSIZE
+  struct pollfd fds;
+  fds.fd = (int)file;
+  fds.events = POLLIN;
+  fds.revents = 0;
+  int ret;
+  do
+  {
+    ret = poll(&fds, 1, (int)timeoutMs);
+  } while ((ret == -1) && (errno == EINTR));
+  return ret;
+}
+
+int32_t platform::read(uint64_t file, uint8_t* buffer, uint32_t maxLength)
+{
+  ssize_t ret;
+  do
+  {
+    ret = ::read((int)file, buffer, maxLength);
+  } while ((ret == -1) && (errno == EINTR));
+  return (int32_t)ret;
+}
+
+int32_t platform::write(uint64_t file, const uint8_t* buffer, uint32_t length)
+{
+  ssize_t ret;
+  do
+  {
+    ret = ::write((int)file, buffer, length);
+  } while ((ret == -1) && (errno == EINTR));
+  return (int32_t)ret;
+}
+
+void platform::close(uint64_t file)
+{
+  ::close((int)file);
+}
+
+bool platform::setNonBlocking(uint64_t file)
+{
+  int flags = fcntl((int)file, F_GETFL, 0);
+  return (flags != -1) && (fcntl((int)file, F_SETFL, flags | O_NONBLOCK) != -1);
+}
+
+int32_t platform::writeNonBlocking(uint64_t file, const uint8_t* buffer,
+  uint32_t length)
+{
+  int32_t ret = platform::write(file, buffer, length);
+  if ((ret == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+  {
+    return 0;
+  }
+  return ret;
+}
+
+// The event loop is an epoll instance plus an eventfd that wakes it, which are packed
+// into the loop's ID
+static int epollFile(uint64_t loopId)
+{
+  return (int)(loopId & 0xffffffff);
+}
+
+static int wakeFile(uint64_t loopId)
+{
+  return (int)(loopId >> 32);
+}
+
+bool platform::createEventLoop(uint64_t& loopId)
+{
+  int epoll = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll == -1)
+  {
+    return false;
+  }
+  int wake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (wake == -1)
+  {
+    ::close(epoll);
+    return false;
+  }
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.u64 = WAKE_TOKEN;
+  if (epoll_ctl(epoll, EPOLL_CTL_ADD, wake, &event) == -1)
+  {
+    ::close(wake);
+    ::close(epoll);
+    return false;
+  }
+  loopId = (uint64_t)epoll | ((uint64_t)wake << 32);
+  return true;
+}
+
+void platform::closeEventLoop(uint64_t loopId)
+{
+  ::close(wakeFile(loopId));
+  ::close(epollFile(loopId));
+}
+
+bool platform::watchFile(uint64_t loopId, uint64_t file, bool forWriting, uint64_t token)
+{
+  struct epoll_event event = {};
+  event.events = forWriting ? EPOLLOUT : EPOLLIN;
+  event.data.u64 = token;
+  return (epoll_ctl(epollFile(loopId), EPOLL_CTL_ADD, (int)file, &event) == 0);
+}
+
+void platform::unwatchFile(uint64_t loopId, uint64_t file, bool forWriting)
+{
+  epoll_ctl(epollFile(loopId), EPOLL_CTL_DEL, (int)file, NULL);
+}
+
+bool platform::watchProcess(uint64_t loopId, uint64_t pid, uint64_t token,
+  uint64_t& watchId)
+{
+  // A pidfd becomes readable when the process exits. They were added in Linux 5.3 so
+  // older kernels report that processes can't be watched
+#ifdef SYS_pidfd_open
+  int pidFile = (int)syscall(SYS_pidfd_open, (pid_t)pid, 0);
+  if (pidFile == -1)
+  {
+    return false;
+  }
+  fcntl(pidFile, F_SETFD, FD_CLOEXEC);
+  if (!watchFile(loopId, (uint64_t)pidFile, false, token))
+  {
+    ::close(pidFile);
+    return false;
+  }
+  watchId = (uint64_t)pidFile;
+  return true;
+#else
+  return false;
+#endif
+}
+
+void platform::unwatchProcess(uint64_t loopId, uint64_t watchId)
+{
+  unwatchFile(loopId, watchId, false);
+  ::close((int)watchId);
+}
+
+bool platform::wakeEventLoop(uint64_t loopId)
+{
+  uint64_t value = 1;
+  return (::write(wakeFile(loopId), &value, sizeof(value)) == sizeof(value));
+}
+
+bool platform::waitForEvents(uint64_t loopId, vector<uint64_t>& tokens)
+{
+  struct epoll_event events[32];
+  int count;
+  do
+  {
+    count = epoll_wait(epollFile(loopId), events, 32, -1);
+  } while ((count == -1) && (errno == EINTR));
+  if (count == -1)
+  {
+    return false;
+  }
+  tokens.clear();
+  for (int i = 0; i < count; ++i)
+  {
+    if (events[i].data.u64 == WAKE_TOKEN)
+    {
+      uint64_t value;
+      while (::read(wakeFile(loopId), &value, sizeof(value)) > 0)
+      {
+      }
+      continue;
+    }
+    tokens.push_back(events[i].data.u64);
+  }
+  return true;
+}
@@ -4,6 +4,8 @@
 #include <fcntl.h>
 #include <pthread.h>
 #include <signal.h>
+#include <sys/event.h>
+#include <sys/mman.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -14,6 +16,10 @@ using namespace std;
 #define PIPE_READ 0
 #define PIPE_WRITE 1
 
+// The identifier and token of the user event that wakes an event loop
+#define WAKE_IDENT 1
+#define WAKE_TOKEN UINT64_MAX
+
 void platform::sleep(uint32_t timeMs)
 {
   usleep(timeMs * 1000);
@@ -124,6 +130,46 @@ bool platform::terminateProcess(uint64_t pid, uint32_t exitCode)
   return (kill((int)pid, SIGKILL) == 0);
 }
 
+bool platform::waitForProcess(uint64_t pid)
+{
+  siginfo_t info;
+  while (waitid(P_PID, (id_t)pid, &info, WEXITED | WNOWAIT) == -1)
+  {
+    if (errno != EINTR)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool platform::reapProcess(uint64_t pid, int32_t& exitCode)
+{
+  int status;
+  int res;
+  do
+  {
+    res = waitpid((int)pid, &status, 0);
+  } while ((res == -1) && (errno == EINTR));
+  if (res != (int)pid)
+  {
+    return false;
+  }
+  if (WIFEXITED(status))
+  {
+    exitCode = WEXITSTATUS(status);
+  }
+  else if (WIFSIGNALED(status))
+  {
+    exitCode = 128 + WTERMSIG(status);
+  }
+  else
+  {
+    return false;
+  }
+  return true;
+}
+
 typedef struct
 {
   runFunction func;
@@ -230,6 +276,123 @@ void platform::closeNamedPipeForReading(uint64_t pipeId)
   ::close((int)pipeId);
 }
 
+bool platform::generateUniqueSharedMemoryName(string& name)
+{
+  // Combine the process ID with a counter so every channel gets its own object. Names
+  // are limited to 31 characters on Mac
+  static atomic<uint32_t> counter(0);
+  char nameBuffer[32];
+  snprintf(nameBuffer, 32, "/eyeNative%d_%u", (int)getpid(), counter++);
+  name = nameBuffer;
+  return true;
+}
+
+bool platform::createSharedMemory(string name, size_t length, uint64_t& memoryId,
+  uint8_t*& memory)
+{
+  // Create a new shared memory object, failing if one already exists with this name,
+  // and map it into our address space
+  int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+  if (fd == -1)
+  {
+    return false;
+  }
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  if (ftruncate(fd, length) == -1)
+  {
+    ::close(fd);
+    shm_unlink(name.c_str());
+    return false;
+  }
+  void* mapped = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mapped == MAP_FAILED)
+  {
+    ::close(fd);
+    shm_unlink(name.c_str());
+    return false;
+  }
+  memoryId = (uint64_t)fd;
+  memory = (uint8_t*)mapped;
+  return true;
+}
+
+bool platform::openSharedMemory(string name, uint64_t& memoryId, uint8_t*& memory,
+  size_t& length)
+{
+  // Open the existing shared memory object and map all of it
+  int fd = shm_open(name.c_str(), O_RDWR, 0);
+  if (fd == -1)
+  {
+    return false;
+  }
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  struct stat info;
+  if ((fstat(fd, &info) == -1) || (info.st_size == 0))
+  {
+    ::close(fd);
+    return false;
+  }
+  void* mapped = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mapped == MAP_FAILED)
+  {
+    ::close(fd);
+    return false;
+  }
+  memoryId = (uint64_t)fd;
+  memory = (uint8_t*)mapped;
+  length = info.st_size;
+  return true;
+}
+
+void platform::closeSharedMemory(string name, uint64_t memoryId, uint8_t* memory,
+  size_t length, bool owner)
+{
+  // Processes that still have the object mapped keep using it after it's unlinked
+  munmap(memory, length);
+  ::close((int)memoryId);
+  if (owner)
+  {
+    shm_unlink(name.c_str());
+  }
+}
+
+bool platform::waitOnSharedValue(atomic<uint32_t>* value, uint32_t expected,
+  uint32_t timeoutMs)
+{
+  // There's no public API for waiting on an address shared between processes on Mac
+  // so poll the value every millisecond instead
+  for (uint32_t elapsed = 0; elapsed < timeoutMs; ++elapsed)
+  {
+    if (value->load() != expected)
+    {
+      return true;
+    }
+    usleep(1000);
+  }
+  return (value->load() != expected);
+}
+
+void platform::wakeSharedValue(atomic<uint32_t>* value)
+{
+  // Waiters poll the value so there's nothing to do here
+}
+
+uint8_t* platform::allocatePages(size_t length)
+{
+  void* pages = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+    -1, 0);
+  if (pages == MAP_FAILED)
+  {
+    return nullptr;
+  }
+  return (uint8_t*)pages;
+}
+
+void platform::freePages(uint8_t* pages, size_t length)
+{
+  munmap(pages, length);
+}
+
 int32_t platform::waitForData(uint64_t file, uint32_t timeoutMs)
 {
   fd_set set;
@@ -255,3 +418,114 @@ void platform::close(uint64_t file)
 {
   ::close((int)file);
 }
+
+bool platform::setNonBlocking(uint64_t file)
+{
+  int flags = fcntl((int)file, F_GETFL, 0);
+  return (flags != -1) && (fcntl((int)file, F_SETFL, flags | O_NONBLOCK) != -1);
+}
+
+int32_t platform::writeNonBlocking(uint64_t file, const uint8_t* buffer,
+  uint32_t length)
+{
+  int32_t ret = platform::write(file, buffer, length);
+  if ((ret == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+  {
+    return 0;
+  }
+  return ret;
+}
+
+bool platform::createEventLoop(uint64_t& loopId)
+{
+  int queue = kqueue();
+  if (queue == -1)
+  {
+    return false;
+  }
+  struct kevent event;
+  EV_SET(&event, WAKE_IDENT, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, (void*)WAKE_TOKEN);
+  if (kevent(queue, &event, 1, NULL, 0, NULL) == -1)
+  {
+    ::close(queue);
+    return false;
+  }
+  loopId = (uint64_t)queue;
+  return true;
+}
+
+void platform::closeEventLoop(uint64_t loopId)
+{
+  ::close((int)loopId);
+}
+
+bool platform::watchFile(uint64_t loopId, uint64_t file, bool forWriting, uint64_t token)
+{
+  struct kevent event;
+  EV_SET(&event, (uintptr_t)file, forWriting ? EVFILT_WRITE : EVFILT_READ, EV_ADD, 0, 0,
+    (void*)token);
+  return (kevent((int)loopId, &event, 1, NULL, 0, NULL) == 0);
+}
+
+void platform::unwatchFile(uint64_t loopId, uint64_t file, bool forWriting)
+{
+  struct kevent event;
+  EV_SET(&event, (uintptr_t)file, forWriting ? EVFILT_WRITE : EVFILT_READ, EV_DELETE, 0,
+    0, NULL);
+  kevent((int)loopId, &event, 1, NULL, 0, NULL);
+}
+
+bool platform::watchProcess(uint64_t loopId, uint64_t pid, uint64_t token,
+  uint64_t& watchId)
+{
+  // The event fires once when the process exits. Adding it fails if the process has
+  // already exited
+  struct kevent event;
+  EV_SET(&event, (uintptr_t)pid, EVFILT_PROC, EV_ADD | EV_ONESHOT, NOTE_EXIT, 0,
+    (void*)token);
+  if (kevent((int)loopId, &event, 1, NULL, 0, NULL) == -1)
+  {
+    return false;
+  }
+  watchId = pid;
+  return true;
+}
+
+void platform::unwatchProcess(uint64_t loopId, uint64_t watchId)
+{
+  // This fails harmlessly if the event has already fired
+  struct kevent event;
+  EV_SET(&event, (uintptr_t)watchId, EVFILT_PROC, EV_DELETE, 0, 0, NULL);
+  kevent((int)loopId, &event, 1, NULL, 0, NULL);
+}
+
+bool platform::wakeEventLoop(uint64_t loopId)
+{
+  struct kevent event;
+  EV_SET(&event, WAKE_IDENT, EVFILT_USER, 0, NOTE_TRIGGER, 0, NULL);
+  return (kevent((int)loopId, &event, 1, NULL, 0, NULL) == 0);
+}
+
+bool platform::waitForEvents(uint64_t loopId, vector<uint64_t>& tokens)
+{
+  struct kevent events[32];
+  int count;
+  do
+  {
+    count = kevent((int)loopId, NULL, 0, events, 32, NULL);
+  } while ((count == -1) && (errno == EINTR));
+  if (count == -1)
+  {
+    return false;
+  }
+  tokens.clear();
+  for (int i = 0; i < count; ++i)
+  {
+    uint64_t token = (uint64_t)events[i].udata;
+    if (token != WAKE_TOKEN)
+    {
+      tokens.push_back(token);
+    }
+  }
+  return true;
+}
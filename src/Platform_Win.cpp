@@ -117,6 +117,22 @@ bool platform::terminateProcess(uint64_t pid, uint32_t exitCode)
   return TerminateProcess((HANDLE)pid, exitCode);
 }
 
+bool platform::waitForProcess(uint64_t pid)
+{
+  return (WaitForSingleObject((HANDLE)pid, INFINITE) == WAIT_OBJECT_0);
+}
+
+bool platform::reapProcess(uint64_t pid, int32_t& exitCode)
+{
+  DWORD code = 0;
+  if (!GetExitCodeProcess((HANDLE)pid, &code) || (code == STILL_ACTIVE))
+  {
+    return false;
+  }
+  exitCode = (int32_t)code;
+  return true;
+}
+
 typedef struct
 {
   runFunction func;
@@ -217,6 +233,112 @@ void platform::closeNamedPipeForReading(uint64_t pipeId)
   
 }
 
+bool platform::generateUniqueSharedMemoryName(string& name)
+{
+  // Combine the process ID with a counter so every channel gets its own object. The
+  // local namespace is shared by all processes in the user's session
+  static atomic<uint32_t> counter(0);
+  char nameBuffer[64];
+  snprintf(nameBuffer, 64, "Local\\eyeNative%lu_%u", GetCurrentProcessId(),
+    (uint32_t)counter++);
+  name = nameBuffer;
+  return true;
+}
+
+bool platform::createSharedMemory(string name, size_t length, uint64_t& memoryId,
+  uint8_t*& memory)
+{
+  // Create a file mapping backed by the page file and map all of it
+  HANDLE mapping = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+    (DWORD)((uint64_t)length >> 32), (DWORD)(length & 0xFFFFFFFF), name.c_str());
+  if (mapping == NULL)
+  {
+    return false;
+  }
+  if (GetLastError() == ERROR_ALREADY_EXISTS)
+  {
+    CloseHandle(mapping);
+    return false;
+  }
+  void* mapped = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, length);
+  if (mapped == NULL)
+  {
+    CloseHandle(mapping);
+    return false;
+  }
+  memoryId = (uint64_t)mapping;
+  memory = (uint8_t*)mapped;
+  return true;
+}
+
+bool platform::openSharedMemory(string name, uint64_t& memoryId, uint8_t*& memory,
+  size_t& length)
+{
+  // Open the existing file mapping and map all of it. The size of the view is rounded
+  // up to a whole number of pages
+  HANDLE mapping = OpenFileMapping(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+  if (mapping == NULL)
+  {
+    return false;
+  }
+  void* mapped = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+  if (mapped == NULL)
+  {
+    CloseHandle(mapping);
+    return false;
+  }
+  MEMORY_BASIC_INFORMATION info;
+  if (VirtualQuery(mapped, &info, sizeof(info)) == 0)
+  {
+    UnmapViewOfFile(mapped);
+    CloseHandle(mapping);
+    return false;
+  }
+  memoryId = (uint64_t)mapping;
+  memory = (uint8_t*)mapped;
+  length = info.RegionSize;
+  return true;
+}
+
+void platform::closeSharedMemory(string name, uint64_t memoryId, uint8_t* memory,
+  size_t length, bool owner)
+{
+  // The mapping is destroyed once every process has closed its handle
+  UnmapViewOfFile(memory);
+  CloseHandle((HANDLE)memoryId);
+}
+
+bool platform::waitOnSharedValue(atomic<uint32_t>* value, uint32_t expected,
+  uint32_t timeoutMs)
+{
+  // WaitOnAddress() only works within a single process so poll the value every
+  // millisecond instead
+  for (uint32_t elapsed = 0; elapsed < timeoutMs; ++elapsed)
+  {
+    if (value->load() != expected)
+    {
+      return true;
+    }
+    Sleep(1);
+  }
+  return (value->load() != expected);
+}
+
+void platform::wakeSharedValue(atomic<uint32_t>* value)
+{
+  // Waiters poll the value so there's nothing to do here
+}
+
+uint8_t* platform::allocatePages(size_t length)
+{
+  return (uint8_t*)VirtualAlloc(NULL, length, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+}
+
+void platform::freePages(uint8_t* pages, size_t length)
+{
+  VirtualFree(pages, 0, MEM_RELEASE);
+}
+
 int32_t platform::waitForData(uint64_t file, uint32_t timeoutMs)
 {
   // This is currently not implemented for Windows
@@ -247,3 +369,55 @@ void platform::close(uint64_t file)
 {
   CloseHandle((HANDLE)file);
 }
+
+bool platform::setNonBlocking(uint64_t file)
+{
+  // Anonymous and named pipes are written synchronously on Windows
+  return false;
+}
+
+int32_t platform::writeNonBlocking(uint64_t file, const uint8_t* buffer,
+  uint32_t length)
+{
+  return platform::write(file, buffer, length);
+}
+
+bool platform::createEventLoop(uint64_t& loopId)
+{
+  // Anonymous pipes can't be waited on together with processes on Windows, so the
+  // pipes are read by their own threads instead
+  return false;
+}
+
+void platform::closeEventLoop(uint64_t loopId)
+{
+}
+
+bool platform::watchFile(uint64_t loopId, uint64_t file, bool forWriting, uint64_t token)
+{
+  return false;
+}
+
+void platform::unwatchFile(uint64_t loopId, uint64_t file, bool forWriting)
+{
+}
+
+bool platform::watchProcess(uint64_t loopId, uint64_t pid, uint64_t token,
+  uint64_t& watchId)
+{
+  return false;
+}
+
+void platform::unwatchProcess(uint64_t loopId, uint64_t watchId)
+{
+}
+
+bool platform::wakeEventLoop(uint64_t loopId)
+{
+  return false;
+}
+
+bool platform::waitForEvents(uint64_t loopId, vector<uint64_t>& tokens)
+{
+  return false;
+}
@@ -0,0 +1,70 @@
+#include "PreviewFramePool.h"
+
+using namespace std;
+using namespace cv;
+
+PreviewFramePool::PreviewFramePool(uint32_t max) :
+  maxFrames(max)
+{
+}
+
+PreviewFramePool::~PreviewFramePool()
+{
+  for (PreviewFrame* frame : freeFrames)
+  {
+    delete frame;
+  }
+}
+
+PreviewFrame* PreviewFramePool::acquire(uint32_t width, uint32_t height)
+{
+  // Prefer a free frame that already has the right size, then any free frame, which
+  // create() will reallocate
+  PreviewFrame* frame = nullptr;
+  {
+    unique_lock<mutex> lock(poolMutex);
+    for (size_t i = 0; i < freeFrames.size(); ++i)
+    {
+      Mat& image = freeFrames[i]->image;
+      if ((image.cols == (int)width) && (image.rows == (int)height))
+      {
+        frame = freeFrames[i];
+        freeFrames.erase(freeFrames.begin() + i);
+        break;
+      }
+    }
+    if ((frame == nullptr) && !freeFrames.empty())
+    {
+      frame = freeFrames.back();
+      freeFrames.pop_back();
+    }
+    if (frame == nullptr)
+    {
+      frame = new PreviewFrame;
+      frameCount += 1;
+    }
+  }
+
+  // This does nothing if the frame already has the right size and type
+  if ((width != 0) && (height != 0))
+  {
+    frame->image.create(height, width, CV_8UC4);
+  }
+  return frame;
+}
+
+void PreviewFramePool::release(PreviewFrame* frame)
+{
+  if (frame == nullptr)
+  {
+    return;
+  }
+  unique_lock<mutex> lock(poolMutex);
+  if (frameCount > maxFrames)
+  {
+    frameCount -= 1;
+    delete frame;
+    return;
+  }
+  freeFrames.push_back(frame);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+// Enough frames for one being read, one waiting in the preview buffer, and a couple
+// being scaled and encoded by getNextFrameAsync() workers
+#define PREVIEW_FRAME_POOL_SIZE 4
+
+// A preview frame and the number the frame thread gave it
+typedef struct
+{
+  cv::Mat image;
+  uint32_t number;
+} PreviewFrame;
+
+// This class recycles the frames that the preview thread reads into so that a preview
+// running at a steady size doesn't allocate any memory. Frames are acquired by the
+// preview thread, pass through the preview buffer, and are released once they've been
+// encoded or replaced by a newer frame.
+class PreviewFramePool
+{
+public:
+  PreviewFramePool(uint32_t maxFrames);
+  virtual ~PreviewFramePool();
+
+  // Returns a frame with the given size. A new frame is allocated if every frame is in
+  // use, and frames beyond the pool's size are freed again when they're released. A
+  // zero size leaves the frame for the caller to size
+  PreviewFrame* acquire(uint32_t width, uint32_t height);
+  void release(PreviewFrame* frame);
+
+private:
+  uint32_t maxFrames;
+  uint32_t frameCount = 0;
+  std::vector<PreviewFrame*> freeFrames;
+  std::mutex poolMutex;
+};
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+
+// The formats that getNextFrame() can return preview frames in
+#define PREVIEW_FORMAT_PNG 0
+#define PREVIEW_FORMAT_RGBA 1
+#define PREVIEW_FORMAT_QOI 2
+#define PREVIEW_FORMAT_JPEG 3
+
+// These options control how preview frames are encoded. They're passed to
+// getNextFrame() as an optional object.
+typedef struct
+{
+  // PNG is the slowest format but the original default. Raw RGBA needs no encoding at
+  // all and can be copied straight into an ImageData object
+  uint32_t format = PREVIEW_FORMAT_PNG;
+
+  // The JPEG quality from 0 to 100
+  uint32_t quality = 90;
+
+  // Return the latest frame if its number is greater than this, even if it has been
+  // returned before. By default only frames that haven't been returned are
+  int64_t newerThan = -1;
+} PreviewOptions;
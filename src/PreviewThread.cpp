@@ -1,14 +1,19 @@
 #include "PreviewThread.h"
 #include "FrameHeader.h"
 #include "Platform.h"
+#include "SharedFrameRing.h"
 
 using namespace std;
 using namespace cv;
 
-PreviewThread::PreviewThread(string name, shared_ptr<Queue<cv::Mat*>> queue) :
+PreviewThread::PreviewThread(string name, shared_ptr<TripleBuffer<PreviewFrame*>> buffer,
+    shared_ptr<PreviewFramePool> pool) :
   Thread("preview"),
   channelName(name),
-  previewQueue(queue)
+  previewBuffer(buffer),
+  framePool(pool),
+  maxSize(0),
+  maxFrameRate(0)
 {
 }
 
@@ -16,6 +21,24 @@ uint32_t PreviewThread::run()
 {
   printf("## Starting preview thread\n");
 
+  // The channel name tells us which transport the frame thread is using
+  uint32_t ret;
+  string prefix = SHARED_FRAME_RING_PREFIX;
+  if (channelName.compare(0, prefix.size(), prefix) == 0)
+  {
+    ret = readSharedMemory();
+  }
+  else
+  {
+    ret = readNamedPipe();
+  }
+
+  printf("## Stopping preview thread\n");
+  return ret;
+}
+
+uint32_t PreviewThread::readNamedPipe()
+{
   // Open the named pipe for reading
   uint64_t namedPipeId = 0;
   if (!platform::openNamedPipeForReading(channelName, namedPipeId))
@@ -25,8 +48,6 @@ uint32_t PreviewThread::run()
   }
 
   uint8_t frameHeader[FRAME_HEADER_SIZE];
-  uint8_t* buffer = 0;
-  uint32_t bufferSize = 0;
   uint32_t number, width, height, length;
   while (!checkForExit())
   {
@@ -42,34 +63,90 @@ uint32_t PreviewThread::run()
       return 1;
     }
 
-    // Read the frame
-    if (bufferSize < length)
+    if ((uint64_t)width * (uint64_t)height * 4 != length)
     {
-      if (bufferSize != 0)
-      {
-        delete [] buffer;
-      }
-      bufferSize = length;
-      buffer = new uint8_t[bufferSize];
+      printf("[PreviewThread] Unexpected frame length\n");
+      return 1;
     }
-    if (!readAll(namedPipeId, buffer, length))
+
+    // Read the frame straight into a pooled matrix and make it the latest frame
+    PreviewFrame* frame = framePool->acquire(width, height);
+    frame->number = number;
+    if (!readAll(namedPipeId, frame->image.data, length))
     {
+      framePool->release(frame);
       printf("[PreviewThread] Failed to read from named pipe\n");
       return 1;
     }
-
-    // Wrap the frame as an OpenCV matrix and add it to the preview queue
-    Mat wrapped(height, width, CV_8UC4, buffer);
-    Mat* copy = new Mat;
-    wrapped.copyTo(*copy);
-    previewQueue->addItem(copy);
+    publishFrame(frame);
   }
 
   platform::closeNamedPipeForReading(namedPipeId);
-  printf("## Stopping preview thread\n");
   return 0;
 }
 
+uint32_t PreviewThread::readSharedMemory()
+{
+  // Map the shared memory ring created by the frame thread
+  string prefix = SHARED_FRAME_RING_PREFIX;
+  SharedFrameRing ring(channelName.substr(prefix.size()));
+  if (!ring.open())
+  {
+    printf("[PreviewThread] Failed to open shared memory\n");
+    return 1;
+  }
+
+  // Wait for the doorbell and copy the most recent frame straight out of the ring into
+  // a pooled matrix. The ring sizes the matrix, so ask the pool for one the same size
+  // as the last frame, which it usually is
+  uint64_t lastFrame = 0;
+  uint32_t width = 0, height = 0;
+  while (!checkForExit())
+  {
+    // Pass the latest preview size and frame rate on to the frame thread
+    uint64_t size = maxSize.load();
+    ring.setRequest((uint32_t)(size >> 32), (uint32_t)(size & 0xFFFFFFFF),
+      maxFrameRate.load());
+
+    if (!ring.waitForFrame(lastFrame, 50))
+    {
+      continue;
+    }
+    PreviewFrame* frame = framePool->acquire(width, height);
+    if (ring.readFrame(lastFrame, frame->number, frame->image))
+    {
+      width = frame->image.cols;
+      height = frame->image.rows;
+      publishFrame(frame);
+    }
+    else
+    {
+      framePool->release(frame);
+    }
+    if (ring.isClosed())
+    {
+      break;
+    }
+  }
+  return 0;
+}
+
+void PreviewThread::setMaxSize(uint32_t maxWidth, uint32_t maxHeight)
+{
+  maxSize = ((uint64_t)maxWidth << 32) | maxHeight;
+}
+
+void PreviewThread::setMaxFrameRate(uint32_t maxFps)
+{
+  maxFrameRate = maxFps;
+}
+
+void PreviewThread::publishFrame(PreviewFrame* frame)
+{
+  // Recycle the previous frame if the renderer didn't take it in time
+  framePool->release(previewBuffer->publish(frame));
+}
+
 bool PreviewThread::readAll(uint64_t file, uint8_t* buffer, uint32_t length)
 {
   uint32_t bytesRead = 0;
@@ -1,22 +1,35 @@
 #pragma once
 
+#include <atomic>
 #include <mutex>
 #include <opencv2/core/core.hpp>
+#include "PreviewFramePool.h"
 #include "Thread.h"
-#include "Queue.hpp"
+#include "TripleBuffer.hpp"
 
 class PreviewThread : public Thread
 {
 public:
-  PreviewThread(std::string channelName, std::shared_ptr<Queue<cv::Mat*>> previewQueue);
+  PreviewThread(std::string channelName,
+    std::shared_ptr<TripleBuffer<PreviewFrame*>> previewBuffer,
+    std::shared_ptr<PreviewFramePool> framePool);
   virtual ~PreviewThread() {};
 
   uint32_t run();
 
+  void setMaxSize(uint32_t maxWidth, uint32_t maxHeight);
+  void setMaxFrameRate(uint32_t maxFps);
+
 protected:
+  uint32_t readNamedPipe();
+  uint32_t readSharedMemory();
   bool readAll(uint64_t file, uint8_t* buffer, uint32_t length);
+  void publishFrame(PreviewFrame* frame);
 
 private:
   std::string channelName;
-  std::shared_ptr<Queue<cv::Mat*>> previewQueue;
+  std::shared_ptr<TripleBuffer<PreviewFrame*>> previewBuffer;
+  std::shared_ptr<PreviewFramePool> framePool;
+  std::atomic<uint64_t> maxSize;
+  std::atomic<uint32_t> maxFrameRate;
 };
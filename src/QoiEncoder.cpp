@@ -0,0 +1,145 @@
+#include "QoiEncoder.h"
+
+using namespace std;
+
+// Define the chunk tags from the specification
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xc0
+#define QOI_OP_RGB 0xfe
+#define QOI_OP_RGBA 0xff
+
+// The longest run that fits in a single chunk
+#define QOI_MAX_RUN 62
+
+#define QOI_HEADER_SIZE 14
+#define QOI_PADDING_SIZE 8
+
+typedef struct
+{
+  uint8_t r, g, b, a;
+} Pixel;
+
+static inline bool equal(const Pixel& a, const Pixel& b)
+{
+  return (a.r == b.r) && (a.g == b.g) && (a.b == b.b) && (a.a == b.a);
+}
+
+static inline uint32_t hashPixel(const Pixel& p)
+{
+  return (p.r * 3 + p.g * 5 + p.b * 7 + p.a * 11) % 64;
+}
+
+static inline uint8_t* writeBigEndian(uint8_t* out, uint32_t value)
+{
+  *out++ = (uint8_t)(value >> 24);
+  *out++ = (uint8_t)(value >> 16);
+  *out++ = (uint8_t)(value >> 8);
+  *out++ = (uint8_t)value;
+  return out;
+}
+
+void qoi::encode(const uint8_t* bgra, size_t stride, uint32_t width, uint32_t height,
+  vector<uint8_t>& output)
+{
+  // Size the output for the worst case, where every pixel needs a full RGBA chunk,
+  // and trim it once we know the actual length
+  output.resize(QOI_HEADER_SIZE + (size_t)width * height * 5 + QOI_PADDING_SIZE);
+  uint8_t* out = output.data();
+
+  // Write the header. The image has four channels and uses the sRGB color space
+  *out++ = 'q';
+  *out++ = 'o';
+  *out++ = 'i';
+  *out++ = 'f';
+  out = writeBigEndian(out, width);
+  out = writeBigEndian(out, height);
+  *out++ = 4;
+  *out++ = 0;
+
+  Pixel index[64] = {};
+  Pixel previous = {0, 0, 0, 255};
+  uint32_t run = 0;
+  for (uint32_t y = 0; y < height; ++y)
+  {
+    const uint8_t* row = bgra + y * stride;
+    bool lastRow = (y == height - 1);
+    for (uint32_t x = 0; x < width; ++x)
+    {
+      const uint8_t* source = row + x * 4;
+      Pixel pixel = {source[2], source[1], source[0], source[3]};
+
+      // Extend the current run if the pixel hasn't changed
+      if (equal(pixel, previous))
+      {
+        run += 1;
+        if ((run == QOI_MAX_RUN) || (lastRow && (x == width - 1)))
+        {
+          *out++ = QOI_OP_RUN | (uint8_t)(run - 1);
+          run = 0;
+        }
+        continue;
+      }
+      if (run > 0)
+      {
+        *out++ = QOI_OP_RUN | (uint8_t)(run - 1);
+        run = 0;
+      }
+
+      // Refer back to a recently seen pixel if possible, otherwise encode the pixel as
+      // the smallest difference from the previous one that fits
+      uint32_t position = hashPixel(pixel);
+      if (equal(index[position], pixel))
+      {
+        *out++ = QOI_OP_INDEX | (uint8_t)position;
+      }
+      else
+      {
+        index[position] = pixel;
+        if (pixel.a == previous.a)
+        {
+          int8_t vr = (int8_t)(pixel.r - previous.r);
+          int8_t vg = (int8_t)(pixel.g - previous.g);
+          int8_t vb = (int8_t)(pixel.b - previous.b);
+          int8_t vgr = (int8_t)(vr - vg);
+          int8_t vgb = (int8_t)(vb - vg);
+          if ((vr > -3) && (vr < 2) && (vg > -3) && (vg < 2) && (vb > -3) && (vb < 2))
+          {
+            *out++ = QOI_OP_DIFF | (uint8_t)((vr + 2) << 4 | (vg + 2) << 2 | (vb + 2));
+          }
+          else if ((vgr > -9) && (vgr < 8) && (vg > -33) && (vg < 32) && (vgb > -9) &&
+            (vgb < 8))
+          {
+            *out++ = QOI_OP_LUMA | (uint8_t)(vg + 32);
+            *out++ = (uint8_t)((vgr + 8) << 4 | (vgb + 8));
+          }
+          else
+          {
+            *out++ = QOI_OP_RGB;
+            *out++ = pixel.r;
+            *out++ = pixel.g;
+            *out++ = pixel.b;
+          }
+        }
+        else
+        {
+          *out++ = QOI_OP_RGBA;
+          *out++ = pixel.r;
+          *out++ = pixel.g;
+          *out++ = pixel.b;
+          *out++ = pixel.a;
+        }
+      }
+      previous = pixel;
+    }
+  }
+
+  // Finish with the end marker, which is seven zeros followed by a one
+  for (uint32_t i = 0; i < QOI_PADDING_SIZE - 1; ++i)
+  {
+    *out++ = 0;
+  }
+  *out++ = 1;
+  output.resize(out - output.data());
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// This function encodes a BGRA image in the "Quite OK Image" format, a simple lossless
+// format that compresses an order of magnitude faster than PNG. See qoiformat.org for
+// the specification.
+namespace qoi
+{
+  void encode(const uint8_t* bgra, size_t stride, uint32_t width, uint32_t height,
+    std::vector<uint8_t>& output);
+}
@@ -0,0 +1,163 @@
+#include "Reactor.h"
+#include "Platform.h"
+
+using namespace std;
+
+Reactor::Reactor() :
+  Thread("reactor")
+{
+}
+
+Reactor::~Reactor()
+{
+  if (isRunning())
+  {
+    signalExit();
+    platform::wakeEventLoop(loopId);
+    waitForCompletion(1000);
+  }
+  if (loopOpen)
+  {
+    platform::closeEventLoop(loopId);
+  }
+}
+
+shared_ptr<Reactor> Reactor::shared()
+{
+  // Only try to start the reactor once. If it can't be started then every caller
+  // uses its fallback
+  static mutex sharedMutex;
+  static shared_ptr<Reactor> sharedReactor;
+  static bool attempted = false;
+  unique_lock<mutex> lock(sharedMutex);
+  if (!attempted)
+  {
+    attempted = true;
+    shared_ptr<Reactor> reactor(new Reactor());
+    if (reactor->open() && reactor->spawn().empty())
+    {
+      sharedReactor = reactor;
+    }
+  }
+  return sharedReactor;
+}
+
+bool Reactor::open()
+{
+  loopOpen = platform::createEventLoop(loopId);
+  return loopOpen;
+}
+
+uint64_t Reactor::watchFile(uint64_t file, bool forWriting, function<void()> callback)
+{
+  shared_ptr<Watch> watch(new Watch);
+  watch->file = file;
+  watch->forWriting = forWriting;
+  watch->process = false;
+  watch->watchId = 0;
+  watch->callback = callback;
+  watch->active = true;
+
+  // Add the watch to the map first so it's found as soon as the file is ready
+  unique_lock<mutex> lock(watchMutex);
+  uint64_t token = nextToken++;
+  watches[token] = watch;
+  if (!platform::watchFile(loopId, file, forWriting, token))
+  {
+    watches.erase(token);
+    return 0;
+  }
+  return token;
+}
+
+uint64_t Reactor::watchProcess(uint64_t pid, function<void()> callback)
+{
+  shared_ptr<Watch> watch(new Watch);
+  watch->file = 0;
+  watch->forWriting = false;
+  watch->process = true;
+  watch->watchId = 0;
+  watch->callback = callback;
+  watch->active = true;
+
+  unique_lock<mutex> lock(watchMutex);
+  uint64_t token = nextToken++;
+  watches[token] = watch;
+  if (!platform::watchProcess(loopId, pid, token, watch->watchId))
+  {
+    watches.erase(token);
+    return 0;
+  }
+  return token;
+}
+
+void Reactor::unwatch(uint64_t token)
+{
+  shared_ptr<Watch> watch;
+  {
+    unique_lock<mutex> lock(watchMutex);
+    auto it = watches.find(token);
+    if (it == watches.end())
+    {
+      return;
+    }
+    watch = it->second;
+    watches.erase(it);
+    removeWatch(watch);
+  }
+
+  // Wait for a callback that's in progress on the reactor thread to return. The
+  // mutex is recursive so callbacks can remove their own watch
+  unique_lock<recursive_mutex> callLock(watch->callMutex);
+  watch->active = false;
+}
+
+void Reactor::removeWatch(shared_ptr<Watch> watch)
+{
+  if (watch->process)
+  {
+    platform::unwatchProcess(loopId, watch->watchId);
+  }
+  else
+  {
+    platform::unwatchFile(loopId, watch->file, watch->forWriting);
+  }
+}
+
+uint32_t Reactor::run()
+{
+  vector<uint64_t> tokens;
+  while (!checkForExit())
+  {
+    if (!platform::waitForEvents(loopId, tokens))
+    {
+      printf("[Reactor] Failed to wait for events\n");
+      break;
+    }
+    for (uint64_t token : tokens)
+    {
+      // Look up the watch. Process watches only fire once so they're removed first
+      shared_ptr<Watch> watch;
+      {
+        unique_lock<mutex> lock(watchMutex);
+        auto it = watches.find(token);
+        if (it == watches.end())
+        {
+          continue;
+        }
+        watch = it->second;
+        if (watch->process)
+        {
+          watches.erase(it);
+          removeWatch(watch);
+        }
+      }
+      unique_lock<recursive_mutex> callLock(watch->callMutex);
+      if (watch->active)
+      {
+        watch->callback();
+      }
+    }
+  }
+  return 0;
+}
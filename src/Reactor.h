@@ -0,0 +1,58 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "Thread.h"
+
+// This class waits on the pipes and child processes of every recording from a single
+// thread using the platform's event loop, instead of each one having threads that
+// poll. Callbacks are made on the reactor thread when a pipe is ready or a process
+// exits, so they must not block. On platforms without an event loop shared() returns
+// null and callers fall back to their own threads.
+class Reactor : public Thread
+{
+public:
+  Reactor();
+  virtual ~Reactor();
+
+  // Returns the reactor shared by the whole process, starting it the first time
+  static std::shared_ptr<Reactor> shared();
+
+  // Calls the callback whenever the file can be read or written. Returns a token that
+  // identifies the watch, or zero if the file can't be watched
+  uint64_t watchFile(uint64_t file, bool forWriting, std::function<void()> callback);
+
+  // Calls the callback once when the process exits. Returns zero if the process can't
+  // be watched, which includes when it has already exited on some platforms
+  uint64_t watchProcess(uint64_t pid, std::function<void()> callback);
+
+  // Stops a watch. The callback won't be called once this returns, except that it may
+  // be called from inside the callback itself
+  void unwatch(uint64_t token);
+
+  uint32_t run();
+
+private:
+  typedef struct
+  {
+    uint64_t file;
+    bool forWriting;
+    bool process;
+    uint64_t watchId;
+    std::function<void()> callback;
+    bool active;
+    std::recursive_mutex callMutex;
+  } Watch;
+
+  bool open();
+  void removeWatch(std::shared_ptr<Watch> watch);
+
+  uint64_t loopId = 0;
+  bool loopOpen = false;
+  uint64_t nextToken = 1;
+  std::map<uint64_t, std::shared_ptr<Watch>> watches;
+  std::mutex watchMutex;
+};
@@ -0,0 +1,221 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+// The size of a cache line. The producer and consumer indices are kept on separate
+// lines so the two threads don't invalidate each other's caches on every operation
+#define RING_CACHE_LINE 64
+
+// This class is a fixed-capacity queue for exactly one producer thread and one
+// consumer thread. Items are passed without taking a lock. A thread that has to wait,
+// either the consumer on an empty queue or the producer on a full one, parks on a
+// condition variable and the other thread only signals it when it's actually parked.
+template <typename T>
+class RingQueue
+{
+public:
+  RingQueue(uint32_t capacity);
+  virtual ~RingQueue() {};
+
+public:
+  bool addItem(T item, int timeout = 0);
+  uint32_t addItems(const T* items, uint32_t count);
+  bool waitItem(T* item, int timeout);
+  uint32_t waitItems(T* items, uint32_t maxCount, int timeout);
+  std::vector<T> waitAllItems(int timeout);
+
+  int size();
+  bool empty();
+  uint32_t capacity();
+
+protected:
+  bool waitUntil(std::atomic<bool>& parked, int timeout, bool forItems);
+  void wake(std::atomic<bool>& parked);
+
+  std::vector<T> itemRing;
+  uint32_t ringMask;
+
+  // Written by the producer
+  alignas(RING_CACHE_LINE) std::atomic<uint32_t> tail;
+  uint32_t cachedHead = 0;
+
+  // Written by the consumer
+  alignas(RING_CACHE_LINE) std::atomic<uint32_t> head;
+  uint32_t cachedTail = 0;
+
+  // Only touched when one side has to wait
+  alignas(RING_CACHE_LINE) std::atomic<bool> consumerParked;
+  std::atomic<bool> producerParked;
+  std::mutex parkMutex;
+  std::condition_variable parkEvent;
+};
+
+template <typename T>
+RingQueue<T>::RingQueue(uint32_t capacity) :
+  tail(0),
+  head(0),
+  consumerParked(false),
+  producerParked(false)
+{
+  // Round the capacity up to a power of two so indices can be masked
+  uint32_t size = 1;
+  while (size < capacity)
+  {
+    size <<= 1;
+  }
+  itemRing.resize(size);
+  ringMask = size - 1;
+}
+
+template <typename T>
+bool RingQueue<T>::addItem(T item, int timeout)
+{
+  uint32_t currentTail = tail.load(std::memory_order_relaxed);
+  if ((currentTail - cachedHead) > ringMask)
+  {
+    cachedHead = head.load(std::memory_order_acquire);
+    if ((currentTail - cachedHead) > ringMask)
+    {
+      if ((timeout <= 0) || !waitUntil(producerParked, timeout, false))
+      {
+        return false;
+      }
+      cachedHead = head.load(std::memory_order_acquire);
+    }
+  }
+  itemRing[currentTail & ringMask] = item;
+  tail.store(currentTail + 1, std::memory_order_seq_cst);
+  wake(consumerParked);
+  return true;
+}
+
+template <typename T>
+uint32_t RingQueue<T>::addItems(const T* items, uint32_t count)
+{
+  uint32_t currentTail = tail.load(std::memory_order_relaxed);
+  if ((ringMask + 1 - (currentTail - cachedHead)) < count)
+  {
+    cachedHead = head.load(std::memory_order_acquire);
+  }
+  uint32_t space = ringMask + 1 - (currentTail - cachedHead);
+  if (count > space)
+  {
+    count = space;
+  }
+  if (count == 0)
+  {
+    return 0;
+  }
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    itemRing[(currentTail + i) & ringMask] = items[i];
+  }
+  tail.store(currentTail + count, std::memory_order_seq_cst);
+  wake(consumerParked);
+  return count;
+}
+
+template <typename T>
+bool RingQueue<T>::waitItem(T* item, int timeout)
+{
+  return (waitItems(item, 1, timeout) == 1);
+}
+
+template <typename T>
+uint32_t RingQueue<T>::waitItems(T* items, uint32_t maxCount, int timeout)
+{
+  uint32_t currentHead = head.load(std::memory_order_relaxed);
+  if (cachedTail == currentHead)
+  {
+    cachedTail = tail.load(std::memory_order_acquire);
+    if (cachedTail == currentHead)
+    {
+      if ((timeout <= 0) || !waitUntil(consumerParked, timeout, true))
+      {
+        return 0;
+      }
+      cachedTail = tail.load(std::memory_order_acquire);
+    }
+  }
+  uint32_t count = cachedTail - currentHead;
+  if (count > maxCount)
+  {
+    count = maxCount;
+  }
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    items[i] = itemRing[(currentHead + i) & ringMask];
+  }
+  head.store(currentHead + count, std::memory_order_seq_cst);
+  wake(producerParked);
+  return count;
+}
+
+template <typename T>
+std::vector<T> RingQueue<T>::waitAllItems(int timeout)
+{
+  std::vector<T> allItems(1);
+  if (waitItems(allItems.data(), 1, timeout) == 0)
+  {
+    allItems.clear();
+    return allItems;
+  }
+  allItems.resize(1 + size());
+  allItems.resize(1 + waitItems(allItems.data() + 1, allItems.size() - 1, 0));
+  return allItems;
+}
+
+template <typename T>
+int RingQueue<T>::size()
+{
+  return (int)(tail.load(std::memory_order_acquire) -
+    head.load(std::memory_order_acquire));
+}
+
+template <typename T>
+bool RingQueue<T>::empty()
+{
+  return (size() == 0);
+}
+
+template <typename T>
+uint32_t RingQueue<T>::capacity()
+{
+  return ringMask + 1;
+}
+
+template <typename T>
+bool RingQueue<T>::waitUntil(std::atomic<bool>& parked, int timeout, bool forItems)
+{
+  // Announce that we're parked before checking the indices one last time. The other
+  // thread updates its index before checking the flag so one of us will always see
+  // the other's change
+  std::unique_lock<std::mutex> lock(parkMutex);
+  parked.store(true, std::memory_order_seq_cst);
+  auto ready = [this, forItems]()
+  {
+    uint32_t used = tail.load(std::memory_order_seq_cst) -
+      head.load(std::memory_order_seq_cst);
+    return forItems ? (used != 0) : (used <= ringMask);
+  };
+  bool ret = parkEvent.wait_for(lock, std::chrono::milliseconds(timeout), ready);
+  parked.store(false, std::memory_order_relaxed);
+  return ret;
+}
+
+template <typename T>
+void RingQueue<T>::wake(std::atomic<bool>& parked)
+{
+  // Taking the lock guarantees the parked thread is either waiting on the condition
+  // variable or hasn't evaluated its predicate yet
+  if (parked.load(std::memory_order_seq_cst))
+  {
+    {
+      std::unique_lock<std::mutex> lock(parkMutex);
+    }
+    parkEvent.notify_all();
+  }
+}
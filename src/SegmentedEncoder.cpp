@@ -0,0 +1,310 @@
+#include "SegmentedEncoder.h"
+#include "Platform.h"
+#include <stdio.h>
+
+using namespace std;
+
+SegmentWorker::SegmentWorker(string exec, uint32_t wid, uint32_t hgt, uint32_t rate,
+    string enc, string path, VideoOptions opt, uint32_t max) :
+  Thread("segment"),
+  executable(exec),
+  width(wid),
+  height(hgt),
+  fps(rate),
+  encoder(enc),
+  outputPath(path),
+  options(opt),
+  maxFrames(max),
+  failed(false)
+{
+  // Leave room for the empty item that tells the worker to finish
+  pendingFrameQueue = shared_ptr<RingQueue<SegmentFrame*>>(
+    new RingQueue<SegmentFrame*>(maxFrames + 1));
+  freeFrameQueue = shared_ptr<RingQueue<SegmentFrame*>>(
+    new RingQueue<SegmentFrame*>(maxFrames));
+}
+
+SegmentWorker::~SegmentWorker()
+{
+  if (isRunning())
+  {
+    terminate();
+  }
+  for (SegmentFrame* frame : pendingFrameQueue->waitAllItems(0))
+  {
+    delete frame;
+  }
+  for (SegmentFrame* frame : freeFrameQueue->waitAllItems(0))
+  {
+    delete frame;
+  }
+}
+
+SegmentFrame* SegmentWorker::acquireFrame()
+{
+  // Reuse a frame the worker is done with, allocating new ones until the worker has
+  // a whole segment in hand
+  SegmentFrame* frame = nullptr;
+  if (freeFrameQueue->waitItem(&frame, 0))
+  {
+    return frame;
+  }
+  if (allocatedFrames < maxFrames)
+  {
+    allocatedFrames += 1;
+    return new SegmentFrame;
+  }
+  while (isRunning())
+  {
+    if (freeFrameQueue->waitItem(&frame, 50))
+    {
+      return frame;
+    }
+  }
+  return nullptr;
+}
+
+bool SegmentWorker::queueFrame(SegmentFrame* frame)
+{
+  while (isRunning())
+  {
+    if (pendingFrameQueue->addItem(frame, 50))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+void SegmentWorker::releaseFrame(SegmentFrame* frame)
+{
+  // The free queue only takes frames from the worker, so free the frame and let the
+  // next acquireFrame() allocate a replacement
+  delete frame;
+  allocatedFrames -= 1;
+}
+
+bool SegmentWorker::finish()
+{
+  // Queue an empty item and wait for the worker to finish its last segment
+  queueFrame(nullptr);
+  waitForCompletion();
+  return !failed;
+}
+
+uint32_t SegmentWorker::run()
+{
+  while (true)
+  {
+    SegmentFrame* frame = nullptr;
+    if (!pendingFrameQueue->waitItem(&frame, 50))
+    {
+      if (checkForExit())
+      {
+        break;
+      }
+      continue;
+    }
+    if (frame == nullptr)
+    {
+      break;
+    }
+
+    // Start a new ffmpeg process whenever the frames move on to another segment. Once
+    // a segment has failed the remaining frames are returned without being encoded so
+    // the frame thread isn't held up
+    if (!failed && ((process == nullptr) || (frame->segment != currentSegment)))
+    {
+      finishSegment();
+      currentSegment = frame->segment;
+      process = shared_ptr<FfmpegProcess>(new FfmpegProcess(executable, width, height,
+        fps, encoder, SegmentedEncoder::segmentPath(outputPath, currentSegment),
+        options));
+      string error = process->start();
+      if (!error.empty())
+      {
+        printf("[SegmentWorker] Failed to start segment %u: %s\n", currentSegment,
+          error.c_str());
+        process = nullptr;
+        failed = true;
+      }
+    }
+    if (!failed && !process->writeFrame(frame->data.data(), frame->data.size(), 0))
+    {
+      printf("[SegmentWorker] Failed to write to segment %u\n", currentSegment);
+      failed = true;
+    }
+    freeFrameQueue->addItem(frame);
+  }
+  finishSegment();
+  return 0;
+}
+
+void SegmentWorker::finishSegment()
+{
+  if (process != nullptr)
+  {
+    process->finish();
+    process = nullptr;
+  }
+}
+
+SegmentedEncoder::SegmentedEncoder(string exec, uint32_t width, uint32_t height,
+    uint32_t fps, string encoder, string path, VideoOptions options) :
+  executable(exec),
+  outputPath(path),
+  segmentFrames(options.segmentFrames)
+{
+  for (uint32_t i = 0; i < options.segmentWorkers; ++i)
+  {
+    workers.push_back(shared_ptr<SegmentWorker>(new SegmentWorker(executable, width,
+      height, fps, encoder, outputPath, options, segmentFrames)));
+  }
+}
+
+SegmentedEncoder::~SegmentedEncoder()
+{
+  workers.clear();
+}
+
+string SegmentedEncoder::start()
+{
+  for (auto& worker : workers)
+  {
+    string error = worker->spawn();
+    if (!error.empty())
+    {
+      return error;
+    }
+  }
+  return "";
+}
+
+bool SegmentedEncoder::writeFrame(uint8_t* data, uint32_t length,
+  int64_t timestamp)
+{
+  if (finished)
+  {
+    return false;
+  }
+
+  // Copy the frame and pass it to the worker that owns its segment. The segments are
+  // constant frame rate so the timestamp isn't needed
+  uint32_t segment = frameCount / segmentFrames;
+  shared_ptr<SegmentWorker> worker = workers[segment % workers.size()];
+  SegmentFrame* frame = worker->acquireFrame();
+  if (frame == nullptr)
+  {
+    return false;
+  }
+  frame->segment = segment;
+  frame->data.assign(data, data + length);
+  if (!worker->queueFrame(frame))
+  {
+    worker->releaseFrame(frame);
+    return false;
+  }
+  frameCount += 1;
+  segmentCount = segment + 1;
+  return !worker->hasFailed();
+}
+
+void SegmentedEncoder::finish()
+{
+  if (finished)
+  {
+    return;
+  }
+  finished = true;
+
+  // Wait for every worker to finish its segments
+  bool succeeded = true;
+  for (auto& worker : workers)
+  {
+    succeeded = worker->finish() && succeeded;
+  }
+  if (!succeeded)
+  {
+    printf("[SegmentedEncoder] Segments failed to encode and have been kept\n");
+    return;
+  }
+  if ((segmentCount > 0) && !joinSegments())
+  {
+    printf("[SegmentedEncoder] Failed to join segments, which have been kept\n");
+  }
+}
+
+string SegmentedEncoder::segmentPath(string outputPath, uint32_t segment)
+{
+  // Insert the segment number before the extension so the segments use the same
+  // container as the output
+  size_t slash = outputPath.find_last_of("/\\");
+  size_t dot = outputPath.find_last_of('.');
+  string stem = outputPath, extension;
+  if ((dot != string::npos) && ((slash == string::npos) || (dot > slash)))
+  {
+    stem = outputPath.substr(0, dot);
+    extension = outputPath.substr(dot);
+  }
+  char number[16];
+  snprintf(number, sizeof(number), ".part%04u", segment);
+  return stem + number + extension;
+}
+
+bool SegmentedEncoder::joinSegments()
+{
+  // List the segments for the concat demuxer. The list lives next to the segments so
+  // it refers to them by file name, quoting any single quotes
+  string listPath = outputPath + ".segments.txt";
+  FILE* list = fopen(listPath.c_str(), "w");
+  if (list == NULL)
+  {
+    return false;
+  }
+  for (uint32_t i = 0; i < segmentCount; ++i)
+  {
+    string path = segmentPath(outputPath, i);
+    size_t slash = path.find_last_of("/\\");
+    string name = (slash == string::npos) ? path : path.substr(slash + 1);
+    string quoted;
+    for (char c : name)
+    {
+      quoted += (c == '\'') ? string("'\\''") : string(1, c);
+    }
+    fprintf(list, "file '%s'\n", quoted.c_str());
+  }
+  fclose(list);
+
+  // Copy the streams into the output without re-encoding them. Any earlier output is
+  // removed first so we can tell whether the join worked
+  remove(outputPath.c_str());
+  vector<string> arguments = {"-f", "concat", "-safe", "0", "-i", listPath, "-c", "copy",
+    "-y", outputPath};
+  shared_ptr<FfmpegProcess> concat(new FfmpegProcess(executable, arguments));
+  string error = concat->start();
+  if (!error.empty())
+  {
+    remove(listPath.c_str());
+    return false;
+  }
+  concat->finish();
+  remove(listPath.c_str());
+  int32_t exitCode = 0;
+  if (concat->getExitCode(exitCode) && (exitCode != 0))
+  {
+    return false;
+  }
+
+  // Only delete the segments once the output exists
+  FILE* output = fopen(outputPath.c_str(), "rb");
+  if (output == NULL)
+  {
+    return false;
+  }
+  fclose(output);
+  for (uint32_t i = 0; i < segmentCount; ++i)
+  {
+    remove(segmentPath(outputPath, i).c_str());
+  }
+  return true;
+}
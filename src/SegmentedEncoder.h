@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include "FfmpegProcess.h"
+#include "RingQueue.hpp"
+#include "Thread.h"
+#include "VideoEncoder.h"
+#include "VideoOptions.h"
+
+typedef struct
+{
+  uint32_t segment;
+  std::vector<uint8_t> data;
+} SegmentFrame;
+
+// This class encodes the segments assigned to one worker. Each segment is written
+// to its own file by a new ffmpeg process, which is finished before the next segment
+// is started.
+class SegmentWorker : public Thread
+{
+public:
+  SegmentWorker(std::string executable, uint32_t width, uint32_t height, uint32_t fps,
+    std::string encoder, std::string outputPath, VideoOptions options,
+    uint32_t maxFrames);
+  virtual ~SegmentWorker();
+
+  // Called by the frame thread to get an empty frame and to queue it once filled.
+  // Both wait while the worker has the maximum number of frames in hand
+  SegmentFrame* acquireFrame();
+  bool queueFrame(SegmentFrame* frame);
+
+  // Called by the frame thread to free an acquired frame it couldn't queue
+  void releaseFrame(SegmentFrame* frame);
+
+  // Called once every frame has been queued. Returns false if any segment failed
+  bool finish();
+
+  bool hasFailed() { return failed; }
+
+  uint32_t run();
+
+private:
+  void finishSegment();
+
+  std::string executable;
+  uint32_t width;
+  uint32_t height;
+  uint32_t fps;
+  std::string encoder;
+  std::string outputPath;
+  VideoOptions options;
+  uint32_t maxFrames;
+  uint32_t allocatedFrames = 0;
+  std::shared_ptr<RingQueue<SegmentFrame*>> pendingFrameQueue;
+  std::shared_ptr<RingQueue<SegmentFrame*>> freeFrameQueue;
+  std::shared_ptr<FfmpegProcess> process;
+  uint32_t currentSegment = 0;
+  std::atomic<bool> failed;
+};
+
+// This class splits the frames into segments of a fixed number of frames and hands
+// them round-robin to a pool of workers, each of which runs its own ffmpeg process.
+// Encoding therefore scales with the number of workers, at the cost of buffering up
+// to one segment of frames per worker. The segments each start with a key frame and
+// are joined without re-encoding by ffmpeg's concat demuxer when the output is
+// finished.
+class SegmentedEncoder : public VideoEncoder
+{
+public:
+  SegmentedEncoder(std::string executable, uint32_t width, uint32_t height,
+    uint32_t fps, std::string encoder, std::string outputPath, VideoOptions options);
+  virtual ~SegmentedEncoder();
+
+  std::string start();
+  bool writeFrame(uint8_t* data, uint32_t length, int64_t timestamp);
+  void finish();
+
+  static std::string segmentPath(std::string outputPath, uint32_t segment);
+
+private:
+  bool joinSegments();
+
+  std::string executable;
+  std::string outputPath;
+  uint32_t segmentFrames;
+  std::vector<std::shared_ptr<SegmentWorker>> workers;
+  uint32_t frameCount = 0;
+  uint32_t segmentCount = 0;
+  bool finished = false;
+};
@@ -0,0 +1,204 @@
+#include "SharedFrameRing.h"
+#include "Platform.h"
+#include <cstring>
+
+using namespace std;
+using namespace cv;
+
+// Identifies a block of shared memory as a frame ring with this layout
+#define SHARED_FRAME_RING_MAGIC 0x45594531
+
+// Slots start on page boundaries
+#define SHARED_FRAME_RING_ALIGNMENT 4096
+
+// The number of times the reader retries when the writer laps it
+#define SHARED_FRAME_RING_READ_ATTEMPTS 4
+
+// The header is shared between processes so its atomics must not rely on locks
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "32-bit atomics must be lock-free");
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "64-bit atomics must be lock-free");
+
+static uint64_t alignLength(uint64_t length)
+{
+  return (length + SHARED_FRAME_RING_ALIGNMENT - 1) &
+    ~(uint64_t)(SHARED_FRAME_RING_ALIGNMENT - 1);
+}
+
+SharedFrameRing::SharedFrameRing(string n) :
+  name(n)
+{
+}
+
+SharedFrameRing::~SharedFrameRing()
+{
+  if (memory != nullptr)
+  {
+    platform::closeSharedMemory(name, memoryId, memory, length, owner);
+  }
+}
+
+bool SharedFrameRing::create(uint32_t maxFrameLength)
+{
+  // Size the block so the header and every slot start on a page boundary
+  uint64_t slotSize = alignLength(maxFrameLength);
+  uint64_t dataOffset = alignLength(sizeof(Header));
+  size_t totalLength = dataOffset + slotSize * SHARED_FRAME_RING_SLOTS;
+  if (!platform::createSharedMemory(name, totalLength, memoryId, memory))
+  {
+    return false;
+  }
+  owner = true;
+  length = totalLength;
+
+  // New shared memory is zero-filled, so only the layout fields need to be set
+  header = (Header*)memory;
+  header->slotCount = SHARED_FRAME_RING_SLOTS;
+  header->slotSize = slotSize;
+  header->dataOffset = dataOffset;
+  atomic_thread_fence(memory_order_release);
+  header->magic = SHARED_FRAME_RING_MAGIC;
+  return true;
+}
+
+bool SharedFrameRing::open()
+{
+  if (!platform::openSharedMemory(name, memoryId, memory, length))
+  {
+    return false;
+  }
+
+  // Make sure the block was created by a compatible writer before trusting it
+  header = (Header*)memory;
+  if ((length < sizeof(Header)) ||
+    (header->magic != SHARED_FRAME_RING_MAGIC) ||
+    (header->slotCount != SHARED_FRAME_RING_SLOTS) ||
+    (header->dataOffset + header->slotSize * header->slotCount > length))
+  {
+    platform::closeSharedMemory(name, memoryId, memory, length, false);
+    memory = nullptr;
+    header = nullptr;
+    return false;
+  }
+  return true;
+}
+
+void SharedFrameRing::writeFrame(uint32_t number, uint32_t width, uint32_t height,
+  const uint8_t* data, uint32_t frameLength)
+{
+  if (frameLength > header->slotSize)
+  {
+    return;
+  }
+
+  // Fill the slot after the most recently published one, marking it as busy while
+  // we do so
+  uint64_t frameCount = header->frameCount.load(memory_order_relaxed);
+  uint32_t index = (uint32_t)(frameCount % SHARED_FRAME_RING_SLOTS);
+  Slot& slot = header->slots[index];
+  uint32_t sequence = slot.sequence.load(memory_order_relaxed);
+  slot.sequence.store(sequence + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  slot.number = number;
+  slot.width = width;
+  slot.height = height;
+  slot.length = frameLength;
+  memcpy(slotData(index), data, frameLength);
+  slot.sequence.store(sequence + 2, memory_order_release);
+
+  // Publish the frame and wake the reader
+  header->frameCount.store(frameCount + 1, memory_order_release);
+  header->doorbell.fetch_add(1, memory_order_release);
+  platform::wakeSharedValue(&header->doorbell);
+}
+
+void SharedFrameRing::markClosed()
+{
+  header->closed.store(1, memory_order_release);
+  header->doorbell.fetch_add(1, memory_order_release);
+  platform::wakeSharedValue(&header->doorbell);
+}
+
+void SharedFrameRing::getRequest(uint32_t& maxWidth, uint32_t& maxHeight,
+  uint32_t& maxFps)
+{
+  // The width and height are packed together so they're always seen as a pair. Zero
+  // means the reader hasn't asked for a limit
+  uint64_t size = header->requestedSize.load(memory_order_relaxed);
+  maxWidth = (uint32_t)(size >> 32);
+  maxHeight = (uint32_t)(size & 0xFFFFFFFF);
+  maxFps = header->requestedFps.load(memory_order_relaxed);
+}
+
+bool SharedFrameRing::waitForFrame(uint64_t lastFrame, uint32_t timeoutMs)
+{
+  // Read the doorbell before checking for a frame so a frame published in between
+  // changes its value and the wait returns immediately
+  uint32_t doorbell = header->doorbell.load(memory_order_acquire);
+  if ((header->frameCount.load(memory_order_acquire) != lastFrame) || isClosed())
+  {
+    return true;
+  }
+  platform::waitOnSharedValue(&header->doorbell, doorbell, timeoutMs);
+  return ((header->frameCount.load(memory_order_acquire) != lastFrame) || isClosed());
+}
+
+bool SharedFrameRing::readFrame(uint64_t& lastFrame, uint32_t& number, Mat& frame)
+{
+  for (uint32_t attempt = 0; attempt < SHARED_FRAME_RING_READ_ATTEMPTS; ++attempt)
+  {
+    // Return false if nothing has been published since the last frame we read
+    uint64_t frameCount = header->frameCount.load(memory_order_acquire);
+    if ((frameCount == 0) || (frameCount == lastFrame))
+    {
+      return false;
+    }
+
+    // Copy the most recent frame and make sure the writer didn't touch the slot while
+    // we were doing so
+    uint32_t index = (uint32_t)((frameCount - 1) % SHARED_FRAME_RING_SLOTS);
+    Slot& slot = header->slots[index];
+    uint32_t sequence = slot.sequence.load(memory_order_acquire);
+    if ((sequence & 1) != 0)
+    {
+      continue;
+    }
+    uint32_t frameNumber = slot.number;
+    uint32_t width = slot.width;
+    uint32_t height = slot.height;
+    uint32_t frameLength = slot.length;
+    if ((frameLength > header->slotSize) ||
+      ((uint64_t)width * (uint64_t)height * 4 != frameLength))
+    {
+      continue;
+    }
+    frame.create(height, width, CV_8UC4);
+    memcpy(frame.data, slotData(index), frameLength);
+    atomic_thread_fence(memory_order_acquire);
+    if (slot.sequence.load(memory_order_relaxed) != sequence)
+    {
+      continue;
+    }
+    number = frameNumber;
+    lastFrame = frameCount;
+    return true;
+  }
+  return false;
+}
+
+bool SharedFrameRing::isClosed()
+{
+  return (header->closed.load(memory_order_acquire) != 0);
+}
+
+void SharedFrameRing::setRequest(uint32_t maxWidth, uint32_t maxHeight,
+  uint32_t maxFps)
+{
+  header->requestedSize.store(((uint64_t)maxWidth << 32) | maxHeight,
+    memory_order_relaxed);
+  header->requestedFps.store(maxFps, memory_order_relaxed);
+}
+
+uint8_t* SharedFrameRing::slotData(uint32_t index)
+{
+  return memory + header->dataOffset + header->slotSize * index;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <opencv2/core/core.hpp>
+
+// Preview channels whose names start with this prefix use shared memory instead of a
+// named pipe
+#define SHARED_FRAME_RING_PREFIX "shm:"
+
+// The number of frame slots in each ring. Three slots let the writer fill one while
+// the reader copies another without either of them waiting
+#define SHARED_FRAME_RING_SLOTS 3
+
+// This class passes preview frames from the frame thread in the main process to the
+// preview thread in the renderer process through a block of shared memory. The block
+// holds a header followed by a fixed number of frame slots:
+//
+// - The writer fills the slots in turn and publishes each frame by incrementing the
+//   frame count, then rings the doorbell to wake the reader.
+// - Each slot is protected by a sequence number that is odd while the slot is being
+//   written. The reader checks the sequence number before and after copying a frame
+//   and tries again if the writer lapped it in the meantime.
+//
+// The reader only ever wants the most recent frame, so it never holds up the writer.
+// It also records the largest size and highest frame rate it will display in the
+// header so the writer can scale and skip frames before copying them.
+class SharedFrameRing
+{
+public:
+  SharedFrameRing(std::string name);
+  virtual ~SharedFrameRing();
+
+  bool create(uint32_t maxFrameLength);
+  bool open();
+
+  // Writer functions
+  void writeFrame(uint32_t number, uint32_t width, uint32_t height, const uint8_t* data,
+    uint32_t length);
+  void markClosed();
+  void getRequest(uint32_t& maxWidth, uint32_t& maxHeight, uint32_t& maxFps);
+
+  // Reader functions
+  bool waitForFrame(uint64_t lastFrame, uint32_t timeoutMs);
+  bool readFrame(uint64_t& lastFrame, uint32_t& number, cv::Mat& frame);
+  bool isClosed();
+  void setRequest(uint32_t maxWidth, uint32_t maxHeight, uint32_t maxFps);
+
+private:
+  typedef struct
+  {
+    std::atomic<uint32_t> sequence;
+    uint32_t number;
+    uint32_t width;
+    uint32_t height;
+    uint32_t length;
+  } Slot;
+
+  typedef struct
+  {
+    uint32_t magic;
+    uint32_t slotCount;
+    uint64_t slotSize;
+    uint64_t dataOffset;
+    std::atomic<uint32_t> doorbell;
+    std::atomic<uint32_t> closed;
+    std::atomic<uint64_t> frameCount;
+    std::atomic<uint64_t> requestedSize;
+    std::atomic<uint32_t> requestedFps;
+    Slot slots[SHARED_FRAME_RING_SLOTS];
+  } Header;
+
+  uint8_t* slotData(uint32_t index);
+
+  std::string name;
+  bool owner = false;
+  uint64_t memoryId = 0;
+  uint8_t* memory = nullptr;
+  size_t length = 0;
+  Header* header = nullptr;
+};
@@ -20,11 +20,17 @@ std::string Thread::spawn()
   {
     return "An instance of the thread is already running";
   }
+  // Mark the thread as running first in case it completes before spawnThread() returns
+  threadMutex.lock();
+  threadRunning = true;
+  threadMutex.unlock();
   if (!platform::spawnThread(runHelper, this, threadId))
   {
+    threadMutex.lock();
+    threadRunning = false;
+    threadMutex.unlock();
     return "Failed to spawn thread";
   }
-  threadRunning = true;
   return "";
 }
 
@@ -58,8 +64,11 @@ std::string Thread::terminate()
 
 void Thread::signalExit()
 {
-  unique_lock<mutex> lock(threadMutex);
-  threadExit = true;
+  {
+    unique_lock<mutex> lock(threadMutex);
+    threadExit = true;
+  }
+  exitSignalled();
 }
 
 bool Thread::checkForExit()
@@ -70,20 +79,32 @@ bool Thread::checkForExit()
 
 void Thread::signalComplete()
 {
+  // Clear the flag under the lock so a thread that has just checked it can't miss
+  // the notification
+  unique_lock<mutex> lock(threadMutex);
   threadRunning = false;
-  completeEvent.notify_one();
+  completeEvent.notify_all();
 }
 
 bool Thread::waitForCompletion(uint32_t timeout)
 {
   unique_lock<mutex> lock(threadMutex);
-  if (threadRunning)
+  completeEvent.wait_for(lock, chrono::milliseconds(timeout), [this]()
   {
-    completeEvent.wait_for(lock, chrono::milliseconds(timeout));
-  }
+    return !threadRunning;
+  });
   return !threadRunning;
 }
 
+void Thread::waitForCompletion()
+{
+  unique_lock<mutex> lock(threadMutex);
+  completeEvent.wait(lock, [this]()
+  {
+    return !threadRunning;
+  });
+}
+
 uint32_t Thread::runStart()
 {
   uint32_t retVal = run();
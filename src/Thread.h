@@ -1,5 +1,6 @@
 #pragma once
 
+#include <condition_variable>
 #include <mutex>
 #include <string>
 
@@ -18,6 +19,11 @@ protected:
   bool checkForExit();
   void signalComplete();
   bool waitForCompletion(uint32_t timeout);
+  void waitForCompletion();
+
+  // Called when the thread is asked to exit so threads that block on something other
+  // than checkForExit() can wake themselves up
+  virtual void exitSignalled() {};
 
 public:
   uint32_t runStart();
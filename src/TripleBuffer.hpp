@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+
+// Set in the shared index when the middle slot holds a value that hasn't been taken
+#define TRIPLE_BUFFER_FRESH 4
+
+// This class hands the latest value from exactly one producer thread to exactly one
+// consumer thread without either of them waiting. The producer owns one slot, the
+// consumer owns another, and publishing or taking a value atomically swaps the
+// thread's slot with the shared middle slot. Only the most recent value is kept, so a
+// consumer that falls behind skips values rather than letting them pile up. Values
+// that were overwritten before the consumer took them are returned by publish() so the
+// producer can recycle them. A default constructed T marks an empty slot.
+template <typename T>
+class TripleBuffer
+{
+public:
+  TripleBuffer();
+  virtual ~TripleBuffer() {};
+
+public:
+  T publish(T value);
+  bool take(T& value);
+
+protected:
+  T slots[3];
+
+  // Only touched by the producer
+  uint32_t backIndex;
+
+  // The index of the middle slot and whether it's fresh, shared by both threads
+  std::atomic<uint32_t> middle;
+
+  // Only touched by the consumer
+  uint32_t frontIndex;
+};
+
+template <typename T>
+TripleBuffer<T>::TripleBuffer() :
+  slots(),
+  backIndex(0),
+  middle(1),
+  frontIndex(2)
+{
+}
+
+template <typename T>
+T TripleBuffer<T>::publish(T value)
+{
+  // Swap the new value into the middle. The slot we get back is either empty because
+  // the consumer took its value or holds a value that was never taken
+  slots[backIndex] = value;
+  uint32_t previous = middle.exchange(backIndex | TRIPLE_BUFFER_FRESH,
+    std::memory_order_acq_rel);
+  backIndex = previous & 3;
+  T stale = slots[backIndex];
+  slots[backIndex] = T();
+  return stale;
+}
+
+template <typename T>
+bool TripleBuffer<T>::take(T& value)
+{
+  if ((middle.load(std::memory_order_relaxed) & TRIPLE_BUFFER_FRESH) == 0)
+  {
+    return false;
+  }
+
+  // Swap our empty slot into the middle and take the value from the one we get back
+  uint32_t previous = middle.exchange(frontIndex, std::memory_order_acq_rel);
+  frontIndex = previous & 3;
+  value = slots[frontIndex];
+  slots[frontIndex] = T();
+  return true;
+}
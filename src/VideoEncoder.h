@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "FfmpegProgress.h"
+
+// This interface is implemented by the backends that turn the frame thread's frames
+// into a video file. Frames are written from the frame thread while the remaining
+// functions are called from the main thread.
+class VideoEncoder
+{
+public:
+  virtual ~VideoEncoder() {};
+
+  // Prepares the encoder to accept frames and returns an error message on failure
+  virtual std::string start() = 0;
+
+  // Encodes a single frame in the pixel format chosen by the video options. The
+  // timestamp is in microseconds from the start of the video
+  virtual bool writeFrame(uint8_t* data, uint32_t length, int64_t timestamp) = 0;
+
+  // Flushes any buffered frames and finalizes the output file
+  virtual void finish() = 0;
+
+  // Returns the latest progress reported by the encoder, if it reports any
+  virtual bool getProgress(EncoderProgress& progress) { return false; }
+
+  // Returns the exit code of the encoder process once finish() has returned, if the
+  // encoder runs in a process
+  virtual bool getExitCode(int32_t& exitCode) { return false; }
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include "ColorConvert.h"
+#include "EncoderOptions.h"
+
+// The backends that can encode the video
+#define VIDEO_BACKEND_FFMPEG 0
+#define VIDEO_BACKEND_LIBAV 1
+
+// Where the timestamps of the frames in the video come from
+#define TIMESTAMPS_FRAME 0
+#define TIMESTAMPS_CAPTURE 1
+
+// What queueNextFrame() does with a frame that doesn't fit in the queue
+#define OVERLOAD_POLICY_DROP_NEWEST 0
+#define OVERLOAD_POLICY_BLOCK 1
+#define OVERLOAD_POLICY_DROP_OLDEST 2
+#define OVERLOAD_POLICY_DUPLICATE_LAST 3
+
+// The default limit on frame data waiting for the frame thread
+#define DEFAULT_MAX_QUEUED_BYTES (1024ull * 1024 * 1024)
+
+// These options control how frames are prepared for the encoder. They're passed to
+// createVideoOutput() as an optional object.
+typedef struct
+{
+  // Convert frames to YUV 4:2:0 before writing them to the encoder instead of sending
+  // BGRA and letting ffmpeg convert them. Requires even dimensions
+  bool convertToYuv = true;
+
+  // The color matrix and range used for the conversion and tagged in the output
+  uint32_t colorMatrix = COLOR_MATRIX_BT601;
+  bool fullRange = false;
+
+  // Either pipe frames to an ffmpeg process or encode them in-process with libavcodec,
+  // which is only available when the module was built with use_libav=1
+  uint32_t backend = VIDEO_BACKEND_FFMPEG;
+
+  // The number of bytes of frames that can wait for the frame thread, with zero meaning
+  // no limit, and what to do with frames that don't fit
+  uint64_t maxQueuedBytes = DEFAULT_MAX_QUEUED_BYTES;
+  uint32_t overloadPolicy = OVERLOAD_POLICY_DROP_NEWEST;
+
+  // Either space frames evenly at the frame rate or use the time each frame was
+  // captured, in which case the video has a variable frame rate
+  uint32_t timestamps = TIMESTAMPS_FRAME;
+
+  // Skip frames that are identical to the previous one instead of encoding them again.
+  // The frames that are written keep their timestamps so the timing is unchanged
+  bool elideDuplicates = false;
+
+  // Split the video into segments of this many frames and encode them in parallel
+  // with this many ffmpeg processes. Segmenting is disabled with fewer than two workers
+  uint32_t segmentWorkers = 0;
+  uint32_t segmentFrames = 0;
+
+  // The quality and speed settings passed to the encoder
+  EncoderOptions encoderOptions;
+} VideoOptions;
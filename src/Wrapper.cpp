@@ -2,22 +2,339 @@
 #include "FfmpegProcess.h"
 #include "FrameThread.h"
 #include "Native.h"
+#include <algorithm>
+#include <cmath>
 #include <stdio.h>
 
 using namespace std;
 
+// Reads an optional capture timestamp argument in milliseconds, as returned by
+// performance.now(), and converts it to microseconds. A missing timestamp is returned
+// as -1 so the native side stamps the frame itself
+static bool getTimestampArgument(const Napi::CallbackInfo& info, size_t index,
+  int64_t& timestamp)
+{
+  timestamp = -1;
+  if ((info.Length() <= index) || info[index].IsUndefined())
+  {
+    return true;
+  }
+  if (!info[index].IsNumber())
+  {
+    return false;
+  }
+  double milliseconds = info[index].As<Napi::Number>().DoubleValue();
+  if (!std::isfinite(milliseconds) || (milliseconds < 0))
+  {
+    return false;
+  }
+  timestamp = llround(milliseconds * 1000);
+  return true;
+}
+
+// Reads an optional string property from an options object
+static bool getStringOption(Napi::Object object, const char* key, string& value)
+{
+  if (!object.Has(key) || object.Get(key).IsUndefined())
+  {
+    return false;
+  }
+  value = object.Get(key).ToString();
+  return true;
+}
+
+// Reads an optional non-negative integer property from an options object
+static string getUnsignedOption(Napi::Object object, const char* key, bool& found,
+  uint32_t& value)
+{
+  found = false;
+  if (!object.Has(key) || object.Get(key).IsUndefined())
+  {
+    return "";
+  }
+  if (!object.Get(key).IsNumber())
+  {
+    return string(key) + " must be a number";
+  }
+  int64_t number = object.Get(key).As<Napi::Number>().Int64Value();
+  if ((number < 0) || (number > UINT32_MAX))
+  {
+    return string(key) + " is out of range";
+  }
+  found = true;
+  value = (uint32_t)number;
+  return "";
+}
+
+// Translates the encoderOptions object passed to createVideoOutput() into encoder
+// options. The values are checked against the encoder later
+static string parseEncoderOptions(Napi::Object object, EncoderOptions& options)
+{
+  getStringOption(object, "profile", options.profile);
+  getStringOption(object, "preset", options.preset);
+  getStringOption(object, "tune", options.tune);
+  bool found;
+  uint32_t value;
+  string error = getUnsignedOption(object, "crf", found, value);
+  if (!error.empty())
+  {
+    return error;
+  }
+  if (found)
+  {
+    options.crf = (int32_t)min(value, (uint32_t)INT32_MAX);
+  }
+  error = getUnsignedOption(object, "threads", found, value);
+  if (!error.empty())
+  {
+    return error;
+  }
+  if (found)
+  {
+    options.threads = (int32_t)min(value, (uint32_t)INT32_MAX);
+  }
+  error = getUnsignedOption(object, "bitrate", found, options.bitrate);
+  if (!error.empty())
+  {
+    return error;
+  }
+  error = getUnsignedOption(object, "gop", found, options.gop);
+  if (!error.empty())
+  {
+    return error;
+  }
+  error = getUnsignedOption(object, "slices", found, options.slices);
+  if (!error.empty())
+  {
+    return error;
+  }
+  if (object.Has("lossless") && !object.Get("lossless").IsUndefined())
+  {
+    options.lossless = object.Get("lossless").ToBoolean();
+  }
+  return "";
+}
+
+// Translates the optional object passed to createVideoOutput() into video options
+static string parseVideoOptions(Napi::Object object, VideoOptions& options)
+{
+  string value;
+  if (getStringOption(object, "pixelFormat", value))
+  {
+    if (value == "yuv420p")
+    {
+      options.convertToYuv = true;
+    }
+    else if (value == "bgra")
+    {
+      options.convertToYuv = false;
+    }
+    else
+    {
+      return "Unsupported pixel format";
+    }
+  }
+  if (getStringOption(object, "colorMatrix", value))
+  {
+    if (value == "bt601")
+    {
+      options.colorMatrix = COLOR_MATRIX_BT601;
+    }
+    else if (value == "bt709")
+    {
+      options.colorMatrix = COLOR_MATRIX_BT709;
+    }
+    else
+    {
+      return "Unsupported color matrix";
+    }
+  }
+  if (getStringOption(object, "colorRange", value))
+  {
+    if (value == "limited")
+    {
+      options.fullRange = false;
+    }
+    else if (value == "full")
+    {
+      options.fullRange = true;
+    }
+    else
+    {
+      return "Unsupported color range";
+    }
+  }
+  if (getStringOption(object, "backend", value))
+  {
+    if (value == "ffmpeg")
+    {
+      options.backend = VIDEO_BACKEND_FFMPEG;
+    }
+    else if (value == "libav")
+    {
+      options.backend = VIDEO_BACKEND_LIBAV;
+    }
+    else
+    {
+      return "Unsupported backend";
+    }
+  }
+  if (object.Has("elideDuplicates") && !object.Get("elideDuplicates").IsUndefined())
+  {
+    options.elideDuplicates = object.Get("elideDuplicates").ToBoolean();
+  }
+  if (getStringOption(object, "timestamps", value))
+  {
+    if (value == "frame")
+    {
+      options.timestamps = TIMESTAMPS_FRAME;
+    }
+    else if (value == "capture")
+    {
+      options.timestamps = TIMESTAMPS_CAPTURE;
+    }
+    else
+    {
+      return "Unsupported timestamps";
+    }
+  }
+  if (getStringOption(object, "overloadPolicy", value))
+  {
+    if (value == "drop-newest")
+    {
+      options.overloadPolicy = OVERLOAD_POLICY_DROP_NEWEST;
+    }
+    else if (value == "block")
+    {
+      options.overloadPolicy = OVERLOAD_POLICY_BLOCK;
+    }
+    else if (value == "drop-oldest")
+    {
+      options.overloadPolicy = OVERLOAD_POLICY_DROP_OLDEST;
+    }
+    else if (value == "duplicate-last")
+    {
+      options.overloadPolicy = OVERLOAD_POLICY_DUPLICATE_LAST;
+    }
+    else
+    {
+      return "Unsupported overload policy";
+    }
+  }
+  if (object.Has("maxQueuedBytes") && !object.Get("maxQueuedBytes").IsUndefined())
+  {
+    if (!object.Get("maxQueuedBytes").IsNumber())
+    {
+      return "maxQueuedBytes must be a number";
+    }
+    int64_t maxQueuedBytes =
+      object.Get("maxQueuedBytes").As<Napi::Number>().Int64Value();
+    if (maxQueuedBytes < 0)
+    {
+      return "maxQueuedBytes is out of range";
+    }
+    options.maxQueuedBytes = (uint64_t)maxQueuedBytes;
+  }
+  bool found;
+  string error = getUnsignedOption(object, "segmentWorkers", found,
+    options.segmentWorkers);
+  if (!error.empty())
+  {
+    return error;
+  }
+  error = getUnsignedOption(object, "segmentFrames", found, options.segmentFrames);
+  if (!error.empty())
+  {
+    return error;
+  }
+  if (object.Has("encoderOptions") && !object.Get("encoderOptions").IsUndefined())
+  {
+    if (!object.Get("encoderOptions").IsObject())
+    {
+      return "encoderOptions must be an object";
+    }
+    error = parseEncoderOptions(object.Get("encoderOptions").As<Napi::Object>(),
+      options.encoderOptions);
+    if (!error.empty())
+    {
+      return error;
+    }
+  }
+  return "";
+}
+
+// Translates the optional object passed to getNextFrame() into preview options
+static string parsePreviewOptions(Napi::Object object, PreviewOptions& options)
+{
+  string value;
+  if (getStringOption(object, "format", value))
+  {
+    if (value == "png")
+    {
+      options.format = PREVIEW_FORMAT_PNG;
+    }
+    else if (value == "rgba")
+    {
+      options.format = PREVIEW_FORMAT_RGBA;
+    }
+    else if (value == "qoi")
+    {
+      options.format = PREVIEW_FORMAT_QOI;
+    }
+    else if (value == "jpeg")
+    {
+      options.format = PREVIEW_FORMAT_JPEG;
+    }
+    else
+    {
+      return "Unsupported preview format";
+    }
+  }
+  if (object.Has("quality") && !object.Get("quality").IsUndefined())
+  {
+    if (!object.Get("quality").IsNumber())
+    {
+      return "Quality must be a number";
+    }
+    int32_t quality = object.Get("quality").As<Napi::Number>().Int32Value();
+    if ((quality < 0) || (quality > 100))
+    {
+      return "Quality must be between 0 and 100";
+    }
+    options.quality = (uint32_t)quality;
+  }
+  if (object.Has("newerThan") && !object.Get("newerThan").IsUndefined())
+  {
+    if (!object.Get("newerThan").IsNumber())
+    {
+      return "newerThan must be a number";
+    }
+    options.newerThan = object.Get("newerThan").As<Napi::Number>().Int64Value();
+  }
+  return "";
+}
+
 Napi::Object wrapper::Init(Napi::Env env, Napi::Object exports)
 {
   exports.Set("initializeFfmpeg", Napi::Function::New(env, wrapper::initializeFfmpeg));
 
   exports.Set("createVideoOutput", Napi::Function::New(env, wrapper::createVideoOutput));
   exports.Set("queueNextFrame", Napi::Function::New(env, wrapper::queueNextFrame));
+  exports.Set("acquireFrameBuffer", Napi::Function::New(env, wrapper::acquireFrameBuffer));
+  exports.Set("submitFrame", Napi::Function::New(env, wrapper::submitFrame));
   exports.Set("checkCompletedFrames", Napi::Function::New(env, wrapper::checkCompletedFrames));
+  exports.Set("getDroppedFrames", Napi::Function::New(env, wrapper::getDroppedFrames));
+  exports.Set("getStats", Napi::Function::New(env, wrapper::getStats));
+  exports.Set("getEncoderProgress", Napi::Function::New(env,
+    wrapper::getEncoderProgress));
+  exports.Set("onFramesCompleted", Napi::Function::New(env, wrapper::onFramesCompleted));
   exports.Set("closeVideoOutput", Napi::Function::New(env, wrapper::closeVideoOutput));
 
   exports.Set("createPreviewChannel", Napi::Function::New(env, wrapper::createPreviewChannel));
   exports.Set("openPreviewChannel", Napi::Function::New(env, wrapper::openPreviewChannel));
   exports.Set("getNextFrame", Napi::Function::New(env, wrapper::getNextFrame));
+  exports.Set("getNextFrameAsync", Napi::Function::New(env, wrapper::getNextFrameAsync));
+  exports.Set("setPreviewFrameRate", Napi::Function::New(env, wrapper::setPreviewFrameRate));
   exports.Set("closePreviewChannel", Napi::Function::New(env, wrapper::closePreviewChannel));
   return exports;
 }
@@ -34,72 +351,324 @@ void wrapper::initializeFfmpeg(const Napi::CallbackInfo& info)
   native::initializeFfmpeg(env, ffmpegPath);
 }
 
-Napi::String wrapper::createVideoOutput(const Napi::CallbackInfo& info)
+Napi::Value wrapper::createVideoOutput(const Napi::CallbackInfo& info)
 {
   Napi::Env env = info.Env();
-  if ((info.Length() != 5) ||
+  if ((info.Length() < 5) || (info.Length() > 6) ||
     !info[0].IsNumber() ||
     !info[1].IsNumber() ||
     !info[2].IsNumber() ||
     !info[3].IsString() ||
-    !info[4].IsString())
+    !info[4].IsString() ||
+    ((info.Length() == 6) && !info[5].IsObject() && !info[5].IsUndefined()))
   {
     Napi::TypeError::New(env, "Incorrect parameter type").ThrowAsJavaScriptException();
-    return Napi::String();
+    return env.Null();
   }
   Napi::Number width = info[0].As<Napi::Number>();
   Napi::Number height = info[1].As<Napi::Number>();
   Napi::Number fps = info[2].As<Napi::Number>();
   Napi::String encoder = info[3].As<Napi::String>();
   Napi::String outputPath = info[4].As<Napi::String>();
-  return Napi::String::New(env, native::createVideoOutput(env, width, height, fps,
-    encoder, outputPath));
+  VideoOptions options;
+  if ((info.Length() == 6) && info[5].IsObject())
+  {
+    string error = parseVideoOptions(info[5].As<Napi::Object>(), options);
+    if (!error.empty())
+    {
+      Napi::TypeError::New(env, error).ThrowAsJavaScriptException();
+      return env.Null();
+    }
+  }
+  uint32_t handle = 0;
+  string error = native::createVideoOutput(env, width, height, fps, encoder, outputPath,
+    options, handle);
+  if (!error.empty())
+  {
+    Napi::Error::New(env, error).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  return Napi::Number::New(env, handle);
 }
 
-Napi::Number wrapper::queueNextFrame(const Napi::CallbackInfo& info)
+Napi::Value wrapper::queueNextFrame(const Napi::CallbackInfo& info)
 {
   Napi::Env env = info.Env();
-  if ((info.Length() != 3) ||
-    !info[0].IsBuffer() ||
-    !info[1].IsNumber() ||
-    !info[2].IsNumber())
+  int64_t timestamp = -1;
+  if ((info.Length() < 4) ||
+    (info.Length() > 5) ||
+    !info[0].IsNumber() ||
+    !info[1].IsBuffer() ||
+    !info[2].IsNumber() ||
+    !info[3].IsNumber() ||
+    !getTimestampArgument(info, 4, timestamp))
   {
     Napi::TypeError::New(env, "Incorrect parameter type").ThrowAsJavaScriptException();
-    return Napi::Number::New(env, -1);
+    return env.Null();
   }
-  Napi::TypedArray typedArray = info[0].As<Napi::TypedArray>();
+  Napi::TypedArray typedArray = info[1].As<Napi::TypedArray>();
   if (typedArray.TypedArrayType() != napi_uint8_array)
   {
     Napi::TypeError::New(env, "Unexpected buffer type").ThrowAsJavaScriptException();
-    return Napi::Number::New(env, -1);
+    return env.Null();
+  }
+  Napi::Number handle = info[0].As<Napi::Number>();
+  Napi::Buffer<uint8_t> frame = info[1].As<Napi::Buffer<uint8_t>>();
+  Napi::Number width = info[2].As<Napi::Number>();
+  Napi::Number height = info[3].As<Napi::Number>();
+  uint32_t status = FRAME_STATUS_DROPPED;
+  int32_t id = native::queueNextFrame(env, handle.Uint32Value(), frame.Data(),
+    frame.Length(), width, height, timestamp, status);
+  const char* statusName = "accepted";
+  switch (status)
+  {
+    case FRAME_STATUS_DELAYED:
+      statusName = "delayed";
+      break;
+    case FRAME_STATUS_DROPPED:
+      statusName = "dropped";
+      break;
+    case FRAME_STATUS_DUPLICATED:
+      statusName = "duplicated";
+      break;
   }
-  Napi::Buffer<uint8_t> frame = info[0].As<Napi::Buffer<uint8_t>>();
+  Napi::Object returnValue = Napi::Object::New(env);
+  returnValue.Set("id", Napi::Number::New(env, id));
+  returnValue.Set("status", Napi::String::New(env, statusName));
+  return returnValue;
+}
+
+Napi::Value wrapper::acquireFrameBuffer(const Napi::CallbackInfo& info)
+{
+  Napi::Env env = info.Env();
+  if ((info.Length() != 3) ||
+    !info[0].IsNumber() ||
+    !info[1].IsNumber() ||
+    !info[2].IsNumber())
+  {
+    Napi::TypeError::New(env, "Incorrect parameter type").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  Napi::Number handle = info[0].As<Napi::Number>();
   Napi::Number width = info[1].As<Napi::Number>();
   Napi::Number height = info[2].As<Napi::Number>();
-  return Napi::Number::New(env, native::queueNextFrame(env, frame.Data(), frame.Length(),
-    width, height));
+  uint32_t bufferHandle = 0;
+  shared_ptr<FrameMemory> memory;
+  if (!native::acquireFrameBuffer(env, handle.Uint32Value(), width, height, bufferHandle,
+    memory))
+  {
+    return env.Null();
+  }
+
+  // Expose the pooled memory as an external array buffer. The finalizer holds a
+  // reference to the memory so it outlives the pool if JavaScript keeps the buffer.
+  // The buffer goes back to the pool if it can't be handed to JavaScript
+  napi_value output_buffer;
+  shared_ptr<FrameMemory>* reference = new shared_ptr<FrameMemory>(memory);
+  napi_status status = napi_create_external_arraybuffer(env, memory->data,
+    memory->length, native::deleteFrameMemory, reference, &output_buffer);
+  if (status != napi_ok)
+  {
+    delete reference;
+    native::releaseFrameBuffer(env, handle.Uint32Value(), bufferHandle);
+    Napi::TypeError::New(env, "Failed to create buffer").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  // The array buffer's finalizer owns the reference from here on
+  napi_value output_array;
+  status = napi_create_typedarray(env, napi_uint8_array, memory->length, output_buffer,
+    0, &output_array);
+  if (status != napi_ok)
+  {
+    native::releaseFrameBuffer(env, handle.Uint32Value(), bufferHandle);
+    Napi::TypeError::New(env, "Failed to create typed array").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  Napi::Object returnValue = Napi::Object::New(env);
+  returnValue.Set("handle", Napi::Number::New(env, bufferHandle));
+  returnValue.Set("buffer", Napi::Value(env, output_array));
+  return returnValue;
+}
+
+Napi::Number wrapper::submitFrame(const Napi::CallbackInfo& info)
+{
+  Napi::Env env = info.Env();
+  int64_t timestamp = -1;
+  if ((info.Length() < 2) ||
+    (info.Length() > 3) ||
+    !info[0].IsNumber() ||
+    !info[1].IsNumber() ||
+    !getTimestampArgument(info, 2, timestamp))
+  {
+    Napi::TypeError::New(env, "Incorrect parameter type").ThrowAsJavaScriptException();
+    return Napi::Number::New(env, -1);
+  }
+  Napi::Number handle = info[0].As<Napi::Number>();
+  Napi::Number bufferHandle = info[1].As<Napi::Number>();
+  return Napi::Number::New(env, native::submitFrame(env, handle.Uint32Value(),
+    bufferHandle.Uint32Value(), timestamp));
 }
 
 Napi::Int32Array wrapper::checkCompletedFrames(const Napi::CallbackInfo& info)
 {
   Napi::Env env = info.Env();
-  vector<int> completedIds = native::checkCompletedFrames(env);
+  if ((info.Length() != 1) || !info[0].IsNumber())
+  {
+    Napi::TypeError::New(env, "Incorrect parameter type").ThrowAsJavaScriptException();
+    return Napi::Int32Array::New(env, 0);
+  }
+  Napi::Number handle = info[0].As<Napi::Number>();
+  vector<int> completedIds = native::checkCompletedFrames(env, handle.Uint32Value());
   Napi::Int32Array returnValue = Napi::Int32Array::New(env, completedIds.size());
   memcpy(returnValue.Data(), completedIds.data(), sizeof(int32_t) * completedIds.size());
   return returnValue;
 }
 
-void wrapper::closeVideoOutput(const Napi::CallbackInfo& info)
+Napi::Number wrapper::getDroppedFrames(const Napi::CallbackInfo& info)
 {
   Napi::Env env = info.Env();
-  native::closeVideoOutput(env);
+  if ((info.Length() != 1) || !info[0].IsNumber())
+  {
+    Napi::TypeError::New(env, "Incorrect parameter type").ThrowAsJavaScriptException();
+    return Napi::Number::New(env, 0);
+  }
+  Napi::Number handle = info[0].As<Napi::Number>();
+  return Napi::Number::New(env, (double)native::getDroppedFrames(env,
+    handle.Uint32Value()));
+}
+
+// Converts a histogram summary to an object with its durations in microseconds
+static Napi::Object histogramObject(Napi::Env env, const HistogramSummary& summary)
+{
+  Napi::Object object = Napi::Object::New(env);
+  object.Set("count", Napi::Number::New(env, (double)summary.count));
+  object.Set("min", Napi::Number::New(env, (double)summary.min));
+  object.Set("mean", Napi::Number::New(env, summary.mean));
+  object.Set("p50", Napi::Number::New(env, (double)summary.p50));
+  object.Set("p90", Napi::Number::New(env, (double)summary.p90));
+  object.Set("p99", Napi::Number::New(env, (double)summary.p99));
+  object.Set("p999", Napi::Number::New(env, (double)summary.p999));
+  object.Set("max", Napi::Number::New(env, (double)summary.max));
+  return object;
+}
+
+Napi::Value wrapper::getStats(const Napi::CallbackInfo& info)
+{
+  Napi::Env env = info.Env();
+  if ((info.Length() < 1) ||
+    (info.Length() > 2) ||
+    !info[0].IsNumber())
+  {
+    Napi::TypeError::New(env, "Incorrect parameter type").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  Napi::Number handle = info[0].As<Napi::Number>();
+  bool reset = (info.Length() == 2) && info[1].ToBoolean();
+  StatsSnapshot stats;
+  uint32_t queueDepth = 0;
+  uint64_t queuedBytes = 0;
+  if (!native::getStats(env, handle.Uint32Value(), reset, stats, queueDepth,
+    queuedBytes))
+  {
+    return env.Null();
+  }
+  Napi::Object returnValue = Napi::Object::New(env);
+  returnValue.Set("queuedFrames", Napi::Number::New(env, (double)stats.queuedFrames));
+  returnValue.Set("writtenFrames", Napi::Number::New(env, (double)stats.writtenFrames));
+  returnValue.Set("writtenBytes", Napi::Number::New(env, (double)stats.writtenBytes));
+  returnValue.Set("droppedFrames", Napi::Number::New(env, (double)stats.droppedFrames));
+  returnValue.Set("queueDepth", Napi::Number::New(env, queueDepth));
+  returnValue.Set("maxQueueDepth", Napi::Number::New(env, stats.maxQueueDepth));
+  returnValue.Set("queuedBytes", Napi::Number::New(env, (double)queuedBytes));
+  Napi::Object stages = Napi::Object::New(env);
+  for (uint32_t i = 0; i < STAGE_COUNT; ++i)
+  {
+    stages.Set(PipelineStats::stageName(i), histogramObject(env, stats.stages[i]));
+  }
+  returnValue.Set("stages", stages);
+  return returnValue;
+}
+
+Napi::Value wrapper::getEncoderProgress(const Napi::CallbackInfo& info)
+{
+  Napi::Env env = info.Env();
+  if ((info.Length() != 1) || !info[0].IsNumber())
+  {
+    Napi::TypeError::New(env, "Incorrect parameter type").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  Napi::Number handle = info[0].As<Napi::Number>();
+  EncoderProgress progress;
+  if (!native::getEncoderProgress(env, handle.Uint32Value(), progress) ||
+    !progress.valid)
+  {
+    return env.Null();
+  }
+  Napi::Object returnValue = Napi::Object::New(env);
+  returnValue.Set("frame", Napi::Number::New(env, (double)progress.frame));
+  returnValue.Set("fps", Napi::Number::New(env, progress.fps));
+  returnValue.Set("speed", Napi::Number::New(env, progress.speed));
+  returnValue.Set("outTime", Napi::Number::New(env, progress.outTime / 1000.0));
+  returnValue.Set("dupFrames", Napi::Number::New(env, (double)progress.dupFrames));
+  returnValue.Set("dropFrames", Napi::Number::New(env, (double)progress.dropFrames));
+  returnValue.Set("totalSize", Napi::Number::New(env, (double)progress.totalSize));
+  returnValue.Set("lagFrames", Napi::Number::New(env, (double)progress.lagFrames));
+  returnValue.Set("ended", Napi::Boolean::New(env, progress.ended));
+  return returnValue;
+}
+
+void wrapper::onFramesCompleted(const Napi::CallbackInfo& info)
+{
+  Napi::Env env = info.Env();
+  if ((info.Length() != 2) ||
+    !info[0].IsNumber() ||
+    !(info[1].IsFunction() || info[1].IsNull() || info[1].IsUndefined()))
+  {
+    Napi::TypeError::New(env, "Incorrect parameter type").ThrowAsJavaScriptException();
+    return;
+  }
+  Napi::Number handle = info[0].As<Napi::Number>();
+  Napi::Function callback;
+  if (info[1].IsFunction())
+  {
+    callback = info[1].As<Napi::Function>();
+  }
+  string error = native::onFramesCompleted(env, handle.Uint32Value(), callback);
+  if (!error.empty())
+  {
+    Napi::TypeError::New(env, error).ThrowAsJavaScriptException();
+  }
+}
+
+Napi::Value wrapper::closeVideoOutput(const Napi::CallbackInfo& info)
+{
+  Napi::Env env = info.Env();
+  if ((info.Length() != 1) || !info[0].IsNumber())
+  {
+    Napi::TypeError::New(env, "Incorrect parameter type").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  Napi::Number handle = info[0].As<Napi::Number>();
+  int32_t exitCode = 0;
+  if (!native::closeVideoOutput(env, handle.Uint32Value(), exitCode))
+  {
+    return env.Null();
+  }
+  return Napi::Number::New(env, exitCode);
 }
 
 Napi::String wrapper::createPreviewChannel(const Napi::CallbackInfo& info)
 {
   Napi::Env env = info.Env();
+  if ((info.Length() != 1) || !info[0].IsNumber())
+  {
+    Napi::TypeError::New(env, "Incorrect parameter type").ThrowAsJavaScriptException();
+    return Napi::String();
+  }
+  Napi::Number handle = info[0].As<Napi::Number>();
   string channelName;
-  string error = native::createPreviewChannel(env, channelName);
+  string error = native::createPreviewChannel(env, handle.Uint32Value(), channelName);
   if (!error.empty())
   {
     Napi::TypeError::New(env, error).ThrowAsJavaScriptException();
@@ -120,41 +689,221 @@ Napi::String wrapper::openPreviewChannel(const Napi::CallbackInfo& info)
   return Napi::String::New(env, native::openPreviewChannel(env, name));
 }
 
-Napi::Value wrapper::getNextFrame(const Napi::CallbackInfo& info)
+// Reads the maximum size and optional options object passed to getNextFrame() and
+// getNextFrameAsync()
+static string parseNextFrameArgs(const Napi::CallbackInfo& info, int& maxWidth,
+  int& maxHeight, PreviewOptions& options, bool& hasOptions)
 {
-  Napi::Env env = info.Env();
-  if ((info.Length() != 2) ||
+  if ((info.Length() < 2) || (info.Length() > 3) ||
     !info[0].IsNumber() ||
-    !info[1].IsNumber())
+    !info[1].IsNumber() ||
+    ((info.Length() == 3) && !info[2].IsObject() && !info[2].IsUndefined()))
   {
-    Napi::TypeError::New(env, "Incorrect parameter type").ThrowAsJavaScriptException();
-    return env.Null();
+    return "Incorrect parameter type";
   }
-  Napi::Number maxWidth = info[0].As<Napi::Number>();
-  Napi::Number maxHeight = info[1].As<Napi::Number>();
-  uint8_t* frame = nullptr;
-  size_t length = 0;
-  if (!native::getNextFrame(env, frame, length, maxWidth, maxHeight))
+  maxWidth = info[0].As<Napi::Number>().Int32Value();
+  maxHeight = info[1].As<Napi::Number>().Int32Value();
+  hasOptions = (info.Length() == 3) && info[2].IsObject();
+  if (hasOptions)
   {
-    return env.Null();
+    return parsePreviewOptions(info[2].As<Napi::Object>(), options);
   }
+  return "";
+}
+
+// Hands encoded preview data to JavaScript without copying it. The array buffer holds a
+// reference to the data, which may be shared with the preview cache and other array
+// buffers, and the finalizer drops it once the array buffer is garbage collected. The
+// data is returned on its own when there are no options so existing callers keep working
+static Napi::Value createPreviewValue(Napi::Env env, shared_ptr<vector<uint8_t>> frame,
+  uint32_t width, uint32_t height, uint32_t number, bool hasOptions, string& error)
+{
+  size_t length = frame->size();
+  shared_ptr<vector<uint8_t>>* reference = new shared_ptr<vector<uint8_t>>(frame);
   napi_value output_buffer;
-  napi_status status = napi_create_external_arraybuffer(env, frame, length,
-    native::deletePreviewFrame, NULL, &output_buffer);
+  napi_status status = napi_create_external_arraybuffer(env, frame->data(), length,
+    native::deletePreviewFrame, reference, &output_buffer);
   if (status != napi_ok)
   {
-    Napi::TypeError::New(env, "Failed to create buffer").ThrowAsJavaScriptException();
-    return env.Null();
+    delete reference;
+    error = "Failed to create buffer";
+    return Napi::Value();
   }  
   napi_value output_array;
   status = napi_create_typedarray(env, napi_uint8_array, length, output_buffer, 0,
     &output_array);
   if (status != napi_ok)
   {
-    Napi::TypeError::New(env, "Failed to create typed array").ThrowAsJavaScriptException();
+    error = "Failed to create typed array";
+    return Napi::Value();
+  }
+  if (!hasOptions)
+  {
+    return Napi::Value(env, output_array);
+  }
+  Napi::Object returnValue = Napi::Object::New(env);
+  returnValue.Set("data", Napi::Value(env, output_array));
+  returnValue.Set("width", Napi::Number::New(env, width));
+  returnValue.Set("height", Napi::Number::New(env, height));
+  returnValue.Set("number", Napi::Number::New(env, number));
+  return returnValue;
+}
+
+// This worker scales and encodes a preview frame on the libuv thread pool and settles
+// the promise returned by getNextFrameAsync() with the result
+class PreviewFrameWorker : public Napi::AsyncWorker
+{
+public:
+  PreviewFrameWorker(Napi::Env env, Napi::Promise::Deferred def,
+      shared_ptr<PreviewFrame> frame, int maxWid, int maxHgt, PreviewOptions opt,
+      bool hasOpt) :
+    Napi::AsyncWorker(env),
+    deferred(def),
+    previewFrame(frame),
+    number(frame->number),
+    maxWidth(maxWid),
+    maxHeight(maxHgt),
+    options(opt),
+    hasOptions(hasOpt)
+  {
+  }
+
+  virtual ~PreviewFrameWorker() {};
+
+protected:
+  void Execute()
+  {
+    // The frame is released as soon as it's been encoded so the pool can reuse it
+    try
+    {
+      encodedFrame = native::processPreviewFrame(previewFrame, width, height, maxWidth,
+        maxHeight, options);
+      previewFrame = nullptr;
+    }
+    catch (const cv::Exception& e)
+    {
+      SetError(e.what());
+    }
+  }
+
+  void OnOK()
+  {
+    Napi::Env env = Env();
+    string error;
+    native::cachePreview(number, maxWidth, maxHeight, options, encodedFrame, width,
+      height);
+    Napi::Value value = createPreviewValue(env, encodedFrame, width, height, number,
+      hasOptions, error);
+    if (!error.empty())
+    {
+      deferred.Reject(Napi::Error::New(env, error).Value());
+      return;
+    }
+    deferred.Resolve(value);
+  }
+
+  void OnError(const Napi::Error& error)
+  {
+    deferred.Reject(error.Value());
+  }
+
+private:
+  Napi::Promise::Deferred deferred;
+  shared_ptr<PreviewFrame> previewFrame;
+  shared_ptr<vector<uint8_t>> encodedFrame;
+  uint32_t number;
+  int maxWidth;
+  int maxHeight;
+  PreviewOptions options;
+  bool hasOptions;
+  uint32_t width = 0;
+  uint32_t height = 0;
+};
+
+Napi::Value wrapper::getNextFrame(const Napi::CallbackInfo& info)
+{
+  Napi::Env env = info.Env();
+  int maxWidth = 0, maxHeight = 0;
+  PreviewOptions options;
+  bool hasOptions = false;
+  string error = parseNextFrameArgs(info, maxWidth, maxHeight, options, hasOptions);
+  if (!error.empty())
+  {
+    Napi::TypeError::New(env, error).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  shared_ptr<vector<uint8_t>> frame;
+  uint32_t width = 0, height = 0, number = 0;
+  if (!native::getNextFrame(env, frame, width, height, number, maxWidth, maxHeight,
+    options))
+  {
     return env.Null();
   }
-  return Napi::Value(env, output_array);
+  Napi::Value value = createPreviewValue(env, frame, width, height, number, hasOptions,
+    error);
+  if (!error.empty())
+  {
+    Napi::TypeError::New(env, error).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  return value;
+}
+
+Napi::Value wrapper::getNextFrameAsync(const Napi::CallbackInfo& info)
+{
+  Napi::Env env = info.Env();
+  Napi::Promise::Deferred deferred = Napi::Promise::Deferred::New(env);
+  int maxWidth = 0, maxHeight = 0;
+  PreviewOptions options;
+  bool hasOptions = false;
+  string error = parseNextFrameArgs(info, maxWidth, maxHeight, options, hasOptions);
+  if (!error.empty())
+  {
+    deferred.Reject(Napi::TypeError::New(env, error).Value());
+    return deferred.Promise();
+  }
+
+  // Take the frame here because the preview buffer belongs to the JavaScript thread,
+  // then leave the slow scaling and encoding to the worker unless the frame has
+  // already been encoded the same way
+  shared_ptr<PreviewFrame> previewFrame = native::takeNextFrame(env, maxWidth,
+    maxHeight, options.newerThan);
+  if (previewFrame == nullptr)
+  {
+    deferred.Resolve(env.Null());
+    return deferred.Promise();
+  }
+  shared_ptr<vector<uint8_t>> frame;
+  uint32_t width = 0, height = 0;
+  if (native::findCachedPreview(previewFrame->number, maxWidth, maxHeight, options,
+    frame, width, height))
+  {
+    Napi::Value value = createPreviewValue(env, frame, width, height,
+      previewFrame->number, hasOptions, error);
+    if (!error.empty())
+    {
+      deferred.Reject(Napi::Error::New(env, error).Value());
+      return deferred.Promise();
+    }
+    deferred.Resolve(value);
+    return deferred.Promise();
+  }
+  PreviewFrameWorker* worker = new PreviewFrameWorker(env, deferred, previewFrame,
+    maxWidth, maxHeight, options, hasOptions);
+  worker->Queue();
+  return deferred.Promise();
+}
+
+void wrapper::setPreviewFrameRate(const Napi::CallbackInfo& info)
+{
+  Napi::Env env = info.Env();
+  if ((info.Length() != 1) || !info[0].IsNumber())
+  {
+    Napi::TypeError::New(env, "Incorrect parameter type").ThrowAsJavaScriptException();
+    return;
+  }
+  Napi::Number maxFps = info[0].As<Napi::Number>();
+  native::setPreviewFrameRate(env, maxFps.Uint32Value());
 }
 
 void wrapper::closePreviewChannel(const Napi::CallbackInfo& info)
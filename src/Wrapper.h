@@ -11,13 +11,21 @@ namespace wrapper
 
   void initializeFfmpeg(const Napi::CallbackInfo& info);
 
-  Napi::String createVideoOutput(const Napi::CallbackInfo& info);
-  Napi::Number queueNextFrame(const Napi::CallbackInfo& info);
+  Napi::Value createVideoOutput(const Napi::CallbackInfo& info);
+  Napi::Value queueNextFrame(const Napi::CallbackInfo& info);
+  Napi::Value acquireFrameBuffer(const Napi::CallbackInfo& info);
+  Napi::Number submitFrame(const Napi::CallbackInfo& info);
   Napi::Int32Array checkCompletedFrames(const Napi::CallbackInfo& info);
-  void closeVideoOutput(const Napi::CallbackInfo& info);
+  Napi::Number getDroppedFrames(const Napi::CallbackInfo& info);
+  Napi::Value getStats(const Napi::CallbackInfo& info);
+  Napi::Value getEncoderProgress(const Napi::CallbackInfo& info);
+  void onFramesCompleted(const Napi::CallbackInfo& info);
+  Napi::Value closeVideoOutput(const Napi::CallbackInfo& info);
 
   Napi::String createPreviewChannel(const Napi::CallbackInfo& info);
   Napi::String openPreviewChannel(const Napi::CallbackInfo& info);
   Napi::Value getNextFrame(const Napi::CallbackInfo& info);
+  Napi::Value getNextFrameAsync(const Napi::CallbackInfo& info);
+  void setPreviewFrameRate(const Napi::CallbackInfo& info);
   void closePreviewChannel(const Napi::CallbackInfo& info);
 }